@@ -0,0 +1,1042 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+/*
+    Time the analysis plugins that Tony builds, on deterministic
+    synthetic signals. The plugins are compiled directly into this
+    program from the same sources (and with the same flags) as the
+    plugin libraries, so no plugin path or host is involved.
+
+    For each case we time process() separately from
+    getRemainingFeatures(): in pYIN the former is the YIN front end,
+    run once per block, and the latter the HMM decoding run once at
+    the end. pYIN decodes the pitch track and then the notes within
+    getRemainingFeatures(), so the "note-hmm" case also times the note
+    HMM on its own, decoding the known pitches of the synthetic melody.
+    The cost of the pitch HMM is the difference between the two.
+
+    With --json, the results are also written to a file, for tracking
+    across releases. The meson benchmark() targets do this.
+
+    On Linux we also report the peak memory used by each case above
+    what was in use before it started, which for pYIN on long inputs
+    is dominated by the state kept for the HMM decoding.
+    --long shows how that and the decoding time grow with recording
+    length. A banded transition layout and a single-precision option
+    for the HMMs would be changes to SparseHMM and MonoPitchHMM in
+    pYIN, and are tracked there; this only measures them.
+
+    The "harmonic-peak" cases time the host-side constrained peak
+    search that Tony runs on cached spectra when re-analysing an
+    outlined region, over a narrow and a wide frequency range. Only
+    the search is timed, not the FFTs that produce its input.
+
+    The "note-boundaries" case times the index Tony uses to move the
+    playhead from one note to the next, over 100,000 notes whatever
+    the signal length: lookups as the process stage, and building the
+    index plus updating it for edits to single notes as the remaining
+    stage.
+
+    With --samples, we instead compare the cost of pYIN's precise
+    ("Unbiased Timing") mode against the default on each WAV file in
+    a directory, such as the samples/ directory in the source tree.
+    This only measures precise mode. Making it faster is a change to
+    YinUtil in pYIN, which is fetched into pyin/ rather than kept
+    here, and is tracked in pYIN itself.
+*/
+
+#include "YinVamp.h"
+#include "PYinVamp.h"
+#include "LocalCandidatePYIN.h"
+#include "MonoNote.h"
+#include "ConstrainedHarmonicPeak.h"
+#include "HarmonicPeak.h"
+#include "NoteBoundaryIndex.h"
+
+#include <vamp-sdk/FFT.h>
+
+#include <vamp-sdk/Plugin.h>
+#include <vamp-sdk/RealTime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+static const float defaultSampleRate = 44100.f;
+static const int stepSize = 256;
+static const int blockSize = 2048;
+
+#ifndef TONY_BENCHMARK_VERSION
+#define TONY_BENCHMARK_VERSION "unknown"
+#endif
+
+struct MelodyNote {
+    double start;
+    double duration;
+    double midiPitch;
+    double vibratoRate;
+    double vibratoDepth; // proportion of frequency
+};
+
+/**
+ * A random but deterministic melody: a sequence of notes of between
+ * 0.2 and 1 second, some followed by a short silence. The same length
+ * and seed always produce the same melody.
+ */
+static vector<MelodyNote>
+melody(double seconds, uint32_t &state)
+{
+    auto random = [&]() { // LCG, uniform in [0, 1)
+        state = state * 1664525u + 1013904223u;
+        return double(state >> 8) / double(1u << 24);
+    };
+
+    vector<MelodyNote> notes;
+    double t = 0.0;
+
+    while (t < seconds) {
+        MelodyNote note;
+        note.start = t;
+        note.duration = 0.2 + random() * 0.8;
+        double gapDuration = random() < 0.3 ? 0.1 : 0.0;
+        note.midiPitch = 48 + floor(random() * 24);
+        note.vibratoRate = 5.0 + random();
+        note.vibratoDepth = 0.01 * random();
+        notes.push_back(note);
+        t += note.duration + gapDuration;
+    }
+
+    return notes;
+}
+
+/**
+ * A sung-melody-like test signal: the notes of melody() with vibrato,
+ * a few harmonics and a soft envelope, with a little noise
+ * throughout. The same length and seed always produce the same
+ * signal.
+ */
+static vector<float>
+synthesise(double seconds, uint32_t seed)
+{
+    const float sampleRate = defaultSampleRate;
+    size_t n = size_t(seconds * sampleRate);
+    vector<float> signal(n, 0.f);
+
+    uint32_t state = seed;
+
+    for (const auto &note: melody(seconds, state)) {
+
+        double f0 = 440.0 * pow(2.0, (note.midiPitch - 69) / 12.0);
+        size_t i = size_t(note.start * sampleRate);
+        size_t noteLength = size_t(note.duration * sampleRate);
+        double phase = 0.0;
+
+        for (size_t j = 0; j < noteLength && i < n; ++j, ++i) {
+            double t = double(j) / sampleRate;
+            double f = f0 * (1.0 + note.vibratoDepth *
+                             sin(2.0 * M_PI * note.vibratoRate * t));
+            phase += 2.0 * M_PI * f / sampleRate;
+            double env = std::min(1.0, std::min(t, note.duration - t) * 20.0);
+            double v = 0.0;
+            for (int h = 1; h <= 5; ++h) {
+                v += sin(h * phase) / h;
+            }
+            signal[i] = float(0.3 * env * v);
+        }
+    }
+
+    auto random = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return double(state >> 8) / double(1u << 24);
+    };
+    
+    for (size_t k = 0; k < n; ++k) {
+        signal[k] += float((random() - 0.5) * 0.002);
+    }
+
+    return signal;
+}
+
+struct Case {
+    string name;
+    std::function<Vamp::Plugin *(float)> create; // null for host code
+    std::map<string, float> parameters;
+    int blockSize;
+    string processStage;   // what process() times, for the JSON output
+    string remainingStage; // and what getRemainingFeatures() times
+    enum Host { NoteHMM, PeakSearch, NoteBoundaries };
+    Host host = NoteHMM; // which host code to time, if create is null
+};
+
+struct Timing {
+    string name;
+    string processStage;
+    string remainingStage;
+    double audioSeconds;
+    int blocks;
+    double processSeconds;
+    double remainingSeconds;
+    double peakMemoryMB; // or negative if unknown
+};
+
+#ifdef __linux__
+
+// Return the value in kB of the given field (e.g. "VmRSS") from
+// /proc/self/status, or -1 if unavailable
+static long
+readStatusKB(string field)
+{
+    std::ifstream status("/proc/self/status");
+    string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0) {
+            return atol(line.c_str() + field.size() + 1);
+        }
+    }
+    return -1;
+}
+
+// Reset the peak resident set size to the current one, so that a
+// later read of VmHWM gives the peak since this call
+static bool
+resetPeakMemory()
+{
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5" << endl;
+    return bool(clear);
+}
+
+#endif
+
+static double
+secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>
+        (std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+measureFrom(bool &measureMemory, long &baseline)
+{
+#ifdef __linux__
+    measureMemory = resetPeakMemory();
+    baseline = readStatusKB("VmRSS");
+#else
+    measureMemory = false;
+    baseline = -1;
+#endif
+}
+
+static double
+measuredPeakMB(bool measureMemory, long baseline)
+{
+#ifdef __linux__
+    long peak = readStatusKB("VmHWM");
+    if (measureMemory && baseline >= 0 && peak >= baseline) {
+        return double(peak - baseline) / 1024.0;
+    }
+#else
+    (void)measureMemory;
+    (void)baseline;
+#endif
+    return -1.0;
+}
+
+static bool
+run(const Case &c, const vector<float> &signal, float sampleRate,
+    Timing &timing)
+{
+    bool measureMemory = false;
+    long baseline = -1;
+    measureFrom(measureMemory, baseline);
+
+    std::unique_ptr<Vamp::Plugin> plugin(c.create(sampleRate));
+
+    for (const auto &p: c.parameters) {
+        plugin->setParameter(p.first, p.second);
+    }
+
+    const int bs = c.blockSize;
+    
+    if (!plugin->initialise(1, stepSize, bs)) {
+        cerr << "ERROR: " << c.name << ": plugin failed to initialise" << endl;
+        return false;
+    }
+
+    // For a frequency-domain plugin we window and transform each
+    // block as a host would, but outside the timed region, so that
+    // only the plugin itself is measured
+    
+    bool frequencyDomain =
+        (plugin->getInputDomain() == Vamp::Plugin::FrequencyDomain);
+    vector<double> window(bs), ri(bs), ii(bs, 0.0), ro(bs), io(bs);
+    for (int k = 0; k < bs; ++k) {
+        window[k] = 0.5 - 0.5 * cos(2.0 * M_PI * k / bs);
+    }
+
+    vector<float> block(frequencyDomain ? bs + 2 : bs, 0.f);
+    const float *input = block.data();
+    int blocks = 0;
+    size_t n = signal.size();
+
+    std::chrono::steady_clock::duration processTime {};
+
+    for (size_t i = 0; i < n; i += stepSize) {
+
+        size_t available = std::min(size_t(bs), n - i);
+
+        if (frequencyDomain) {
+            for (int k = 0; k < bs; ++k) {
+                ri[k] = (size_t(k) < available ?
+                         window[k] * signal[i + k] : 0.0);
+            }
+            Vamp::FFT::forward(bs, ri.data(), ii.data(), ro.data(), io.data());
+            for (int k = 0; k <= bs / 2; ++k) {
+                block[k * 2] = float(ro[k]);
+                block[k * 2 + 1] = float(io[k]);
+            }
+        } else {
+            memcpy(block.data(), signal.data() + i, available * sizeof(float));
+            if (available < size_t(bs)) {
+                std::fill(block.begin() + available, block.end(), 0.f);
+            }
+        }
+
+        // Frequency-domain timestamps are of the centre of the block
+        long frame = long(i) + (frequencyDomain ? bs / 2 : 0);
+        
+        auto start = std::chrono::steady_clock::now();
+        (void)plugin->process
+            (&input, Vamp::RealTime::frame2RealTime
+             (frame, (unsigned int)sampleRate));
+        processTime += std::chrono::steady_clock::now() - start;
+        ++blocks;
+    }
+
+    timing.processSeconds =
+        std::chrono::duration<double>(processTime).count();
+
+    auto start = std::chrono::steady_clock::now();
+    (void)plugin->getRemainingFeatures();
+    timing.remainingSeconds = secondsSince(start);
+
+    timing.peakMemoryMB = measuredPeakMB(measureMemory, baseline);
+
+    timing.name = c.name;
+    timing.processStage = c.processStage;
+    timing.remainingStage = c.remainingStage;
+    timing.audioSeconds = double(n) / sampleRate;
+    timing.blocks = blocks;
+    return true;
+}
+
+// The MonoNote constructor gained an argument in later pYIN versions
+template <typename M>
+static std::unique_ptr<M>
+makeMonoNote()
+{
+    if constexpr (std::is_constructible<M, bool>::value) {
+        return std::make_unique<M>(false);
+    } else {
+        return std::make_unique<M>();
+    }
+}
+
+/**
+ * Time the note HMM alone, decoding the pitches of the melody that
+ * synthesise() would produce for the same length and seed. Each
+ * voiced frame has a single pitch candidate (as a MIDI pitch), which
+ * is what pYIN passes to it from its smoothed pitch track.
+ */
+static bool
+runNoteHMM(const Case &c, double seconds, Timing &timing)
+{
+    bool measureMemory = false;
+    long baseline = -1;
+    measureFrom(measureMemory, baseline);
+
+    const double frameDuration = double(stepSize) / defaultSampleRate;
+    int frames = int(seconds / frameDuration);
+
+    vector<vector<std::pair<double, double>>> pitchProb(frames);
+
+    uint32_t state = 1;
+    for (const auto &note: melody(seconds, state)) {
+        int first = int(note.start / frameDuration);
+        int last = int((note.start + note.duration) / frameDuration);
+        for (int f = first; f < last && f < frames; ++f) {
+            double t = f * frameDuration - note.start;
+            double cents = 1200.0 * log2
+                (1.0 + note.vibratoDepth *
+                 sin(2.0 * M_PI * note.vibratoRate * t));
+            pitchProb[f].push_back({ note.midiPitch + cents / 100.0, 0.9 });
+        }
+    }
+
+    auto mn = makeMonoNote<MonoNote>();
+
+    auto start = std::chrono::steady_clock::now();
+    auto out = mn->process(pitchProb);
+    timing.remainingSeconds = secondsSince(start);
+
+    if (out.size() != pitchProb.size()) {
+        cerr << "ERROR: " << c.name << ": expected " << pitchProb.size()
+             << " frames from note HMM, got " << out.size() << endl;
+        return false;
+    }
+
+    timing.processSeconds = 0.0;
+    timing.peakMemoryMB = measuredPeakMB(measureMemory, baseline);
+    timing.name = c.name;
+    timing.processStage = c.processStage;
+    timing.remainingStage = c.remainingStage;
+    timing.audioSeconds = seconds;
+    timing.blocks = frames;
+    return true;
+}
+
+/**
+ * Time HarmonicPeak::findBatch over the magnitude spectra of the
+ * signal, at the case's block size and within its minfreq and
+ * maxfreq. The spectra are calculated a batch at a time outside the
+ * timed region, as Tony takes them from its spectrum cache.
+ */
+static bool
+runHarmonicPeak(const Case &c, const vector<float> &signal, float sampleRate,
+                Timing &timing)
+{
+    bool measureMemory = false;
+    long baseline = -1;
+    measureFrom(measureMemory, baseline);
+
+    const int bs = c.blockSize;
+    const int hs = bs / 2;
+    const int batch = 256;
+    
+    HarmonicPeak search(bs, sampleRate,
+                        c.parameters.at("minfreq"), c.parameters.at("maxfreq"),
+                        5);
+
+    vector<double> window(bs), ri(bs), ii(bs, 0.0), ro(bs), io(bs);
+    for (int k = 0; k < bs; ++k) {
+        window[k] = 0.5 - 0.5 * cos(2.0 * M_PI * k / bs);
+    }
+
+    vector<vector<float>> mags(batch, vector<float>(hs + 1));
+    vector<const float *> columns(batch);
+    vector<double> peaks(batch);
+    
+    int frames = 0;
+    int voiced = 0;
+    size_t n = signal.size();
+    std::chrono::steady_clock::duration searchTime {};
+
+    for (size_t i = 0; i < n; ) {
+
+        int count = 0;
+        for ( ; count < batch && i < n; ++count, i += stepSize) {
+            size_t available = std::min(size_t(bs), n - i);
+            for (int k = 0; k < bs; ++k) {
+                ri[k] = (size_t(k) < available ?
+                         window[k] * signal[i + k] : 0.0);
+            }
+            Vamp::FFT::forward(bs, ri.data(), ii.data(), ro.data(), io.data());
+            for (int k = 0; k <= hs; ++k) {
+                mags[count][k] = float(sqrt(ro[k] * ro[k] + io[k] * io[k]));
+            }
+            columns[count] = mags[count].data();
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        search.findBatch(columns.data(), count, peaks.data());
+        searchTime += std::chrono::steady_clock::now() - start;
+
+        for (int k = 0; k < count; ++k) {
+            if (peaks[k] > 0.0) ++voiced;
+        }
+        frames += count;
+    }
+
+    if (voiced == 0) {
+        cerr << "ERROR: " << c.name << ": no peaks found" << endl;
+        return false;
+    }
+    
+    timing.processSeconds =
+        std::chrono::duration<double>(searchTime).count();
+    timing.remainingSeconds = 0.0;
+    timing.peakMemoryMB = measuredPeakMB(measureMemory, baseline);
+    timing.name = c.name;
+    timing.processStage = c.processStage;
+    timing.remainingStage = c.remainingStage;
+    timing.audioSeconds = double(n) / sampleRate;
+    timing.blocks = frames;
+    return true;
+}
+
+/**
+ * Time NoteBoundaryIndex over 100,000 notes of the lengths melody()
+ * produces. The lookups are from random frames, alternately forwards
+ * and backwards, as when the user steps through the notes. Each edit
+ * changes the length of one note and updates the index over the
+ * range affected, as Tony does on a change notification from its
+ * note model. The index is then checked against one built afresh.
+ */
+static bool
+runNoteBoundaries(const Case &c, Timing &timing)
+{
+    bool measureMemory = false;
+    long baseline = -1;
+    measureFrom(measureMemory, baseline);
+
+    typedef sv::sv_frame_t Frame;
+
+    const int noteCount = 100000;
+    const int lookups = 1000000;
+    const int edits = 10000;
+
+    struct Note { Frame frame; Frame duration; };
+    vector<Note> notes;
+    notes.reserve(noteCount);
+
+    uint32_t state = 1;
+    auto random = [&]() { // LCG, uniform in [0, 1)
+        state = state * 1664525u + 1013904223u;
+        return double(state >> 8) / double(1u << 24);
+    };
+
+    Frame t = stepSize;
+    for (int i = 0; i < noteCount; ++i) {
+        Frame duration = Frame((0.2 + random() * 0.8) * defaultSampleRate);
+        notes.push_back({ t, duration });
+        t += duration + (random() < 0.3 ? Frame(0.1 * defaultSampleRate) : 0);
+    }
+    const Frame total = t;
+
+    auto boundariesOf = [&](int from, int to) {
+        vector<Frame> boundaries;
+        for (int i = std::max(from, 0); i < std::min(to, noteCount); ++i) {
+            NoteBoundaryIndex::addBoundaries(notes[i].frame,
+                                             notes[i].duration,
+                                             boundaries);
+        }
+        return boundaries;
+    };
+
+    NoteBoundaryIndex index;
+    
+    auto start = std::chrono::steady_clock::now();
+    index.reset(boundariesOf(0, noteCount));
+    std::chrono::steady_clock::duration updateTime =
+        std::chrono::steady_clock::now() - start;
+
+    vector<Frame> queries(lookups);
+    for (auto &q: queries) q = Frame(random() * double(total));
+
+    Frame sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; ++i) {
+        sum += ((i % 2) ?
+                index.getPrevious(queries[i]) :
+                index.getNext(queries[i]));
+    }
+    timing.processSeconds = secondsSince(start);
+
+    // Each edit lengthens or shortens a note without reaching the
+    // next one, so the range affected runs from the note's start to
+    // whichever of its old and new end boundaries is later
+    
+    for (int i = 0; i < edits; ++i) {
+        int k = int(random() * (noteCount - 1));
+        Frame room = notes[k+1].frame - notes[k].frame - 1;
+        Frame before = notes[k].duration;
+        notes[k].duration = std::max(Frame(1), Frame(random() * double(room)));
+        Frame rangeStart = notes[k].frame;
+        Frame rangeEnd = rangeStart + std::max(before, notes[k].duration) + 1;
+        vector<Frame> boundaries = boundariesOf(k - 1, k + 2);
+        start = std::chrono::steady_clock::now();
+        index.replaceWithin(rangeStart, rangeEnd, std::move(boundaries));
+        updateTime += std::chrono::steady_clock::now() - start;
+    }
+
+    NoteBoundaryIndex reference;
+    reference.reset(boundariesOf(0, noteCount));
+    if (reference.getCount() != index.getCount()) {
+        cerr << "ERROR: " << c.name << ": index has " << index.getCount()
+             << " boundaries after edits, expected "
+             << reference.getCount() << endl;
+        return false;
+    }
+    for (int i = 0; i < lookups; i += 97) {
+        if (index.getNext(queries[i]) != reference.getNext(queries[i]) ||
+            index.getPrevious(queries[i]) != reference.getPrevious(queries[i])) {
+            cerr << "ERROR: " << c.name << ": wrong boundary after edits near "
+                 << queries[i] << endl;
+            return false;
+        }
+    }
+    if (sum == 0) {
+        cerr << "ERROR: " << c.name << ": no boundaries found" << endl;
+        return false;
+    }
+
+    timing.remainingSeconds = std::chrono::duration<double>(updateTime).count();
+    timing.peakMemoryMB = measuredPeakMB(measureMemory, baseline);
+    timing.name = c.name;
+    timing.processStage = c.processStage;
+    timing.remainingStage = c.remainingStage;
+    timing.audioSeconds = double(total) / defaultSampleRate;
+    timing.blocks = lookups;
+    return true;
+}
+
+static vector<Case>
+getCases()
+{
+    // Block sizes are those Tony uses for each plugin
+    return {
+        { "yin",
+          [](float rate) { return new YinVamp(rate); },
+          {}, blockSize,
+          "yin", "" },
+        { "pyin-default",
+          [](float rate) { return new PYinVamp(rate); },
+          { { "precisetime", 0.f } }, blockSize,
+          "yin front end", "pitch and note hmm" },
+        { "pyin-precise",
+          [](float rate) { return new PYinVamp(rate); },
+          { { "precisetime", 1.f } }, blockSize,
+          "yin front end", "pitch and note hmm" },
+        { "note-hmm",
+          nullptr,
+          {}, 0,
+          "", "note hmm" },
+        { "local-candidate-pyin",
+          [](float rate) { return new LocalCandidatePYIN(rate); },
+          {}, blockSize,
+          "yin front end", "candidate pitch hmms" },
+        { "constrained-harmonic-peak",
+          [](float rate) { return new ConstrainedHarmonicPeak(rate); },
+          { { "minfreq", 100.f }, { "maxfreq", 600.f } }, 4096,
+          "harmonic peak search", "" },
+        { "harmonic-peak-narrow",
+          nullptr,
+          { { "minfreq", 200.f }, { "maxfreq", 300.f } }, 4096,
+          "host harmonic peak search", "", Case::PeakSearch },
+        { "harmonic-peak-wide",
+          nullptr,
+          { { "minfreq", 60.f }, { "maxfreq", 1500.f } }, 4096,
+          "host harmonic peak search", "", Case::PeakSearch },
+        { "note-boundaries",
+          nullptr,
+          {}, 0,
+          "note boundary lookup", "index build and note edits",
+          Case::NoteBoundaries },
+    };
+}
+
+static const Case &
+getCase(string name)
+{
+    static vector<Case> cases = getCases();
+    for (const auto &c: cases) {
+        if (c.name == name) return c;
+    }
+    throw std::logic_error("no such case: " + name);
+}
+
+/**
+ * Read a PCM or float WAV file, mixed down to mono. Return false and
+ * set error if the file cannot be read.
+ */
+static bool
+readWav(string path, vector<float> &samples, float &rate, string &error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "failed to open";
+        return false;
+    }
+
+    auto u16 = [](const char *p) {
+        return uint16_t(uint8_t(p[0]) | (uint8_t(p[1]) << 8));
+    };
+    auto u32 = [](const char *p) {
+        return uint32_t(uint8_t(p[0]) | (uint8_t(p[1]) << 8) |
+                        (uint8_t(p[2]) << 16) | (uint32_t(uint8_t(p[3])) << 24));
+    };
+
+    char header[12];
+    if (!in.read(header, 12) || strncmp(header, "RIFF", 4) ||
+        strncmp(header + 8, "WAVE", 4)) {
+        error = "not a RIFF/WAVE file";
+        return false;
+    }
+
+    int format = 0, channels = 0, bits = 0;
+    rate = 0.f;
+
+    char chunk[8];
+    while (in.read(chunk, 8)) {
+
+        uint32_t size = u32(chunk + 4);
+        vector<char> data(size);
+        if (!in.read(data.data(), size)) break;
+        if (size % 2) in.ignore(1);
+
+        if (!strncmp(chunk, "fmt ", 4) && size >= 16) {
+            format = u16(data.data());
+            channels = u16(data.data() + 2);
+            rate = float(u32(data.data() + 4));
+            bits = u16(data.data() + 14);
+            if (format == 0xfffe && size >= 26) { // extensible
+                format = u16(data.data() + 24);
+            }
+            continue;
+        }
+
+        if (strncmp(chunk, "data", 4)) continue;
+
+        if (channels < 1 || rate <= 0.f ||
+            !((format == 1 && (bits == 16 || bits == 24 || bits == 32)) ||
+              (format == 3 && bits == 32))) {
+            error = "unsupported sample format";
+            return false;
+        }
+
+        int bytes = bits / 8;
+        size_t frames = size / (size_t(bytes) * channels);
+        samples.assign(frames, 0.f);
+
+        for (size_t i = 0; i < frames; ++i) {
+            float sum = 0.f;
+            for (int c = 0; c < channels; ++c) {
+                const char *p = data.data() + (i * channels + c) * bytes;
+                float v = 0.f;
+                if (format == 3) {
+                    uint32_t u = u32(p);
+                    memcpy(&v, &u, sizeof(v));
+                } else if (bits == 16) {
+                    v = float(int16_t(u16(p))) / 32768.f;
+                } else if (bits == 24) {
+                    uint32_t u = (uint32_t(uint8_t(p[0])) << 8) |
+                        (uint32_t(uint8_t(p[1])) << 16) |
+                        (uint32_t(uint8_t(p[2])) << 24);
+                    v = float(int32_t(u)) / 2147483648.f;
+                } else {
+                    v = float(int32_t(u32(p))) / 2147483648.f;
+                }
+                sum += v;
+            }
+            samples[i] = sum / float(channels);
+        }
+
+        return true;
+    }
+
+    error = "no audio data found";
+    return false;
+}
+
+/**
+ * Compare precise-mode with default-mode pYIN on every WAV file in a
+ * directory, and report the ratio of their total costs. The timings
+ * for each file are added to timings, named for the case and file.
+ */
+static bool
+compareSamples(string dir, vector<Timing> &timings)
+{
+    vector<string> paths;
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().extension() == ".wav") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    if (ec || paths.empty()) {
+        cerr << "ERROR: no WAV files found in \"" << dir << "\"" << endl;
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    cout << std::left << std::setw(24) << "file"
+         << std::right << std::setw(10) << "audio(s)"
+         << std::setw(14) << "default(s)"
+         << std::setw(14) << "precise(s)"
+         << std::setw(10) << "ratio" << endl;
+
+    double defaultTotal = 0.0, preciseTotal = 0.0;
+
+    for (const auto &path: paths) {
+
+        vector<float> samples;
+        float rate = 0.f;
+        string error;
+        if (!readWav(path, samples, rate, error)) {
+            cerr << "WARNING: skipping \"" << path << "\": " << error << endl;
+            continue;
+        }
+        if (samples.size() < size_t(blockSize)) {
+            continue; // too short to say anything about
+        }
+
+        Timing d, p;
+        if (!run(getCase("pyin-default"), samples, rate, d) ||
+            !run(getCase("pyin-precise"), samples, rate, p)) {
+            return false;
+        }
+
+        string file = std::filesystem::path(path).filename().string();
+        d.name += ":" + file;
+        p.name += ":" + file;
+        timings.push_back(d);
+        timings.push_back(p);
+
+        double dt = d.processSeconds + d.remainingSeconds;
+        double pt = p.processSeconds + p.remainingSeconds;
+        defaultTotal += dt;
+        preciseTotal += pt;
+
+        cout << std::left << std::setw(24) << file
+             << std::right << std::fixed << std::setprecision(1)
+             << std::setw(10) << d.audioSeconds
+             << std::setprecision(4)
+             << std::setw(14) << dt
+             << std::setw(14) << pt
+             << std::setprecision(2)
+             << std::setw(10) << (dt > 0.0 ? pt / dt : 0.0) << endl;
+    }
+
+    // The target is for precise mode to cost no more than about 1.5
+    // times the default. We report against it but do not fail, as
+    // the result depends on the machine.
+    
+    const double target = 1.5;
+    double ratio = (defaultTotal > 0.0 ? preciseTotal / defaultTotal : 0.0);
+    cout << "precise/default cost ratio over all files: "
+         << std::setprecision(2) << ratio << " (target " << target << ", "
+         << (ratio <= target ? "met" : "not met") << ")" << endl;
+
+    return true;
+}
+
+static string
+jsonString(string s)
+{
+    string out = "\"";
+    for (char ch: s) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+/**
+ * Write the timings to a JSON file, with the Tony version they were
+ * measured at. Return false if the file could not be written.
+ */
+static bool
+writeJson(string path, const vector<Timing> &timings)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << std::setprecision(6)
+        << "{\n  \"version\": " << jsonString(TONY_BENCHMARK_VERSION)
+        << ",\n  \"sample_rate\": " << defaultSampleRate
+        << ",\n  \"step_size\": " << stepSize
+        << ",\n  \"results\": [";
+
+    for (size_t i = 0; i < timings.size(); ++i) {
+        const Timing &t = timings[i];
+        out << (i > 0 ? "," : "") << "\n    {"
+            << " \"case\": " << jsonString(t.name)
+            << ", \"audio_seconds\": " << t.audioSeconds
+            << ", \"frames\": " << t.blocks
+            << ", \"process_stage\": " << jsonString(t.processStage)
+            << ", \"process_seconds\": " << t.processSeconds
+            << ", \"remaining_stage\": " << jsonString(t.remainingStage)
+            << ", \"remaining_seconds\": " << t.remainingSeconds
+            << ", \"peak_memory_mb\": ";
+        if (t.peakMemoryMB >= 0.0) out << t.peakMemoryMB;
+        else out << "null";
+        out << " }";
+    }
+
+    out << "\n  ]\n}\n";
+    return bool(out);
+}
+
+static void
+usage(const char *name)
+{
+    cerr << "\nTime Tony's analysis plugins, and its own constrained peak "
+         << "search and note\nboundary index, on synthetic data.\n\n"
+         << "Usage:\n\n  " << name << " [--seconds <s>] [--case <name>] [--long]\n"
+         << "      [--json <file>]\n"
+         << "  " << name << " --samples <dir> [--json <file>]\n\n"
+         << "  --seconds <s>: Length of test signal; may be repeated "
+         << "(default 10 and 60).\n"
+         << "  --case <name>: Run only the named case; may be repeated.\n"
+         << "  --long: Run default pYIN on 5, 20 and 60 minute signals, "
+         << "to show how the\n    HMM decoding time and memory use grow "
+         << "with length.\n"
+         << "  --json <file>: Also write the results to <file> as JSON.\n"
+         << "  --samples <dir>: Compare the cost of precise and default "
+         << "pYIN on the WAV files in <dir>.\n"
+         << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    vector<double> lengths;
+    vector<string> only;
+    string jsonPath;
+    string samplesDir;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            lengths.push_back(atof(argv[++i]));
+            if (lengths.back() <= 0.0) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--case" && i + 1 < argc) {
+            only.push_back(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--long") {
+            // HMM decoding time and memory for long recordings
+            lengths.insert(lengths.end(), { 300.0, 1200.0, 3600.0 });
+            only.push_back("pyin-default");
+        } else if (arg == "--samples" && i + 1 < argc) {
+            samplesDir = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (samplesDir != "") {
+        vector<Timing> timings;
+        bool ok = compareSamples(samplesDir, timings);
+        if (jsonPath != "" && !writeJson(jsonPath, timings)) {
+            cerr << "ERROR: failed to write \"" << jsonPath << "\"" << endl;
+            ok = false;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (lengths.empty()) {
+        lengths = { 10.0, 60.0 };
+    }
+
+    for (const auto &name: only) {
+        try {
+            (void)getCase(name);
+        } catch (const std::logic_error &e) {
+            cerr << "ERROR: " << e.what() << endl;
+            return 2;
+        }
+    }
+
+    cout << std::left << std::setw(28) << "case"
+         << std::right << std::setw(10) << "audio(s)"
+         << std::setw(10) << "frames"
+         << std::setw(14) << "frames/s"
+         << std::setw(14) << "process(s)"
+         << std::setw(14) << "remaining(s)"
+         << std::setw(10) << "peak(MB)" << endl;
+
+    bool ok = true;
+    vector<Timing> timings;
+
+    for (double seconds: lengths) {
+
+        vector<float> signal = synthesise(seconds, 1);
+
+        for (const auto &c: getCases()) {
+
+            if (!only.empty() &&
+                std::find(only.begin(), only.end(), c.name) == only.end()) {
+                continue;
+            }
+
+            Timing t;
+            bool success = false;
+            if (c.create) {
+                success = run(c, signal, defaultSampleRate, t);
+            } else if (c.host == Case::PeakSearch) {
+                success = runHarmonicPeak(c, signal, defaultSampleRate, t);
+            } else if (c.host == Case::NoteBoundaries) {
+                success = runNoteBoundaries(c, t);
+            } else {
+                success = runNoteHMM(c, seconds, t);
+            }
+            if (!success) {
+                ok = false;
+                continue;
+            }
+            timings.push_back(t);
+
+            // Throughput of the per-frame stage, or of the whole
+            // thing for a case (such as note-hmm) that has only one
+            double stageSeconds = (t.processSeconds > 0.0 ?
+                                   t.processSeconds : t.remainingSeconds);
+
+            cout << std::left << std::setw(28) << t.name
+                 << std::right << std::fixed << std::setprecision(1)
+                 << std::setw(10) << t.audioSeconds
+                 << std::setw(10) << t.blocks
+                 << std::setw(14) << (stageSeconds > 0.0 ?
+                                      t.blocks / stageSeconds : 0.0)
+                 << std::setprecision(4)
+                 << std::setw(14) << t.processSeconds
+                 << std::setw(14) << t.remainingSeconds
+                 << std::setprecision(1) << std::setw(10);
+            if (t.peakMemoryMB >= 0.0) cout << t.peakMemoryMB;
+            else cout << "n/a";
+            cout << endl;
+        }
+    }
+
+    if (jsonPath != "" && !writeJson(jsonPath, timings)) {
+        cerr << "ERROR: failed to write \"" << jsonPath << "\"" << endl;
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -14,12 +14,19 @@
 */
 
 #include "Analyser.h"
+#include "AnalysisParameters.h"
+#include "AnalysisCache.h"
+#include "RegionEdit.h"
+#include "HarmonicPeak.h"
 
 #include "transform/TransformFactory.h"
 #include "transform/ModelTransformer.h"
 #include "transform/FeatureExtractionModelTransformer.h"
 #include "framework/Document.h"
 #include "data/model/WaveFileModel.h"
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/NoteModel.h"
+#include "base/Preferences.h"
 #include "view/Pane.h"
 #include "view/PaneStack.h"
 #include "layer/Layer.h"
@@ -32,10 +39,11 @@
 #include "layer/LayerFactory.h"
 #include "layer/SpectrogramLayer.h"
 #include "layer/Colour3DPlotLayer.h"
-#include "layer/ShowLayerCommand.h"
 
 #include <QSettings>
 #include <QMutexLocker>
+#include <QTimer>
+#include <QThread>
 
 using std::vector;
 using std::cerr;
@@ -47,10 +55,36 @@ Analyser::Analyser() :
     m_document(0),
     m_paneStack(0),
     m_pane(0),
+    m_candidateLayer(0),
     m_currentCandidate(-1),
     m_candidatesVisible(false),
-    m_currentAsyncHandle(0)
+    m_currentAsyncHandle(0),
+    m_previewPitchLayer(0),
+    m_previewNoteLayer(0),
+    m_previewChunk(-1),
+    m_previewAsyncHandle(0),
+    m_previewHarvestPending(false),
+    m_candidateCache(AnalysisParameters::stepSize),
+    m_speculationTimer(new QTimer(this)),
+    m_speculationFrame(0),
+    m_speculationAsyncHandle(0),
+    m_speculationStart(0),
+    m_speculationEnd(0),
+    m_speculationWholeFile(false),
+    m_speculationHarvestPending(false),
+    m_deltaAsyncHandle(0),
+    m_deltaStart(0),
+    m_deltaEnd(0),
+    m_deltaHarvestPending(false),
+    m_hashGeneration(0)
 {
+    // Wait for navigation to settle for a moment before speculating,
+    // but without restarting the wait on every move, which during
+    // playback would mean never starting at all
+    m_speculationTimer->setSingleShot(true);
+    m_speculationTimer->setInterval(500);
+    connect(m_speculationTimer, SIGNAL(timeout()), this, SLOT(speculate()));
+
     QSettings settings;
     settings.beginGroup("LayerDefaults");
     settings.setValue
@@ -69,16 +103,19 @@ Analyser::Analyser() :
 
 Analyser::~Analyser()
 {
+    // A content hash may still be in progress. Its result is posted
+    // to us, and the post is dropped when we go, but the thread must
+    // not outlive us
+    for (auto t: m_hashThreads) {
+        t->wait();
+        delete t;
+    }
 }
 
 std::map<QString, QVariant>
 Analyser::getAnalysisSettings()
 {
-    return { { "precision-analysis", false },
-             { "lowamp-analysis", true },
-             { "onset-analysis", true },
-             { "prune-analysis", true }
-    };
+    return AnalysisParameters::getSettingDefaults();
 }
 
 QString
@@ -90,6 +127,10 @@ Analyser::newFileLoaded(Document *doc, ModelId model,
     m_paneStack = paneStack;
     m_pane = pane;
 
+    m_candidateCache.clear();
+    m_preAnalysis.clear();
+    m_spectrumCache.reset();
+
     if (!ModelById::isa<WaveFileModel>(m_fileModel)) {
         return "Internal error: Analyser::newFileLoaded() called with no model, or a non-WaveFileModel";
     }
@@ -113,6 +154,8 @@ Analyser::analyseExistingFile()
     if (!m_pane) return "Internal error: Analyser::analyseExistingFile() called with no pane present";
 
     if (m_fileModel.isNone()) return "Internal error: Analyser::analyseExistingFile() called with no model present";
+
+    stopPreview();
     
     if (m_layers[PitchTrack]) {
         m_document->removeLayerFromView(m_pane, m_layers[PitchTrack]);
@@ -129,10 +172,7 @@ Analyser::analyseExistingFile()
 QString
 Analyser::doAllAnalyses(bool withPitchTrack)
 {
-    m_reAnalysingSelection = Selection();
-    m_reAnalysisCandidates.clear();
-    m_currentCandidate = -1;
-    m_candidatesVisible = false;
+    discardPitchCandidates();
 
     // Note that we need at least one main-model layer (time ruler,
     // waveform or what have you). It could be hidden if we don't want
@@ -171,9 +211,31 @@ Analyser::fileClosed()
 {
     cerr << "Analyser::fileClosed" << endl;
     m_layers.clear();
-    m_reAnalysisCandidates.clear();
+    m_pendingCacheKey = "";
+    ++m_hashGeneration;
+
+    // The document is going away with all of its layers, so we just
+    // forget about the preview rather than tidying it up
+    m_previewTransforms.clear();
+    m_previewPitchLayer = 0;
+    m_previewNoteLayer = 0;
+    m_previewChunksDone.clear();
+    m_previewChunk = -1;
+    m_previewAsyncHandle = 0;
+    m_previewChunkLayers.clear();
+    m_candidateOverlay.clear();
+    m_candidateLayer = 0;
     m_currentCandidate = -1;
     m_reAnalysingSelection = Selection();
+
+    m_speculationTimer->stop();
+    m_speculationAsyncHandle = 0;
+    m_speculationLayers.clear();
+    m_deltaAsyncHandle = 0;
+    m_deltaLayers.clear();
+    m_candidateCache.clear();
+    m_preAnalysis.clear();
+    m_spectrumCache.reset();
 }
 
 bool
@@ -217,6 +279,8 @@ Analyser::layerCompletionChanged(ModelId)
 
     emit initialAnalysisCompleted();
 
+    stopPreview();
+
     if (!m_layers[Audio]) {
         return;
     }
@@ -243,6 +307,15 @@ Analyser::layerCompletionChanged(ModelId)
             model->extendEndFrame(endFrame);
         }
     }
+
+    if (m_pendingCacheKey != "") {
+        storeAnalysesInCache();
+    }
+
+    // Now there is time to spare for the pitch candidates
+    if (m_pane) {
+        navigatedTo(m_pane->getCentreFrame());
+    }
 }
 
 QString
@@ -381,15 +454,6 @@ Analyser::addAnalyses()
         }
     }
 
-    TransformFactory *tf = TransformFactory::getInstance();
-    
-    QString plugname = "pYIN";
-    QString base = "vamp:pyin:pyin:";
-    QString f0out = "smoothedpitchtrack";
-    QString noteout = "notes";
-
-    Transforms transforms;
-
 /*!!! we could have more than one pitch track...
     QString cx = "vamp:cepstral-pitchtracker:cepstral-pitchtracker:f0";
     if (tf->haveTransform(cx)) {
@@ -402,85 +466,55 @@ Analyser::addAnalyses()
     }
 */
 
-    QString notFound = tr("Transform \"%1\" not found. Unable to analyse audio file.<br><br>Is the %2 Vamp plugin correctly installed?");
-    if (!tf->haveTransform(base + f0out)) {
-	return notFound.arg(base + f0out).arg(plugname);
+    QString error;
+    Transforms transforms = AnalysisParameters::fromSettings().getTransforms
+        (waveFileModel->getSampleRate(), error);
+    if (transforms.empty()) {
+        return error;
     }
-    if (!tf->haveTransform(base + noteout)) {
-	return notFound.arg(base + noteout).arg(plugname);
-    }
-
-    QSettings settings;
-    settings.beginGroup("Analyser");
 
-    bool precise = false, lowamp = true, onset = true, prune = true;
-    
-    std::map<QString, bool &> flags {
-        { "precision-analysis", precise },
-        { "lowamp-analysis", lowamp },
-        { "onset-analysis", onset },
-        { "prune-analysis", prune }
-    };
-
-    auto keyMap = getAnalysisSettings();
-    
-    for (auto p: flags) {
-        auto ki = keyMap.find(p.first);
-        if (ki != keyMap.end()) {
-            p.second = settings.value(ki->first, ki->second).toBool();
+    // If we have analysed this audio with the same transforms before,
+    // reuse the results rather than running pYIN again. That needs
+    // the file's content hash, which we only have at once if the file
+    // is unchanged since it was last hashed; otherwise we start the
+    // analysis anyway and hash the file in the background (see
+    // contentHashed)
+
+    m_pendingCacheKey = "";
+    ++m_hashGeneration;
+
+    QString cacheKey;
+    if (AnalysisCache::isEnabled()) {
+        QString path = waveFileModel->getLocalFilename();
+        sv_samplerate_t rate = waveFileModel->getSampleRate();
+        bool normalised = Preferences::getInstance()->getNormaliseAudio();
+        QString content = AnalysisCache::getKnownContentHash(path);
+        if (content != "") {
+            cacheKey = AnalysisCache::makeKey
+                (content, rate, normalised, transforms);
         } else {
-            throw std::logic_error("Internal error: One or more analysis settings keys not found in map: check addAnalyses and getAnalysisSettings");
+            startContentHash(path, rate, normalised, transforms);
         }
     }
 
-    settings.endGroup();
-
-    Transform t = tf->getDefaultTransformFor
-        (base + f0out, waveFileModel->getSampleRate());
-    t.setStepSize(256);
-    t.setBlockSize(2048);
-
-    if (precise) {
-        cerr << "setting parameters for precise mode" << endl;
-        t.setParameter("precisetime", 1);
-    } else {
-        cerr << "setting parameters for vague mode" << endl;
-        t.setParameter("precisetime", 0);
-    }
-
-    if (lowamp) {
-        cerr << "setting parameters for lowamp suppression" << endl;
-        t.setParameter("lowampsuppression", 0.2f);
-    } else {
-        cerr << "setting parameters for no lowamp suppression" << endl;
-        t.setParameter("lowampsuppression", 0.0f);
-    }
-
-    if (onset) {
-        cerr << "setting parameters for increased onset sensitivity" << endl;
-        t.setParameter("onsetsensitivity", 0.7f);
-    } else {
-        cerr << "setting parameters for non-increased onset sensitivity" << endl;
-        t.setParameter("onsetsensitivity", 0.0f);
+    std::vector<Layer *> layers;
+    if (cacheKey != "") {
+        layers = addCachedAnalyses(cacheKey);
     }
 
-    if (prune) {
-        cerr << "setting parameters for duration pruning" << endl;
-        t.setParameter("prunethresh", 0.1f);
-    } else {
-        cerr << "setting parameters for no duration pruning" << endl;
-        t.setParameter("prunethresh", 0.0f);
+    if (layers.empty()) {
+        m_pendingCacheKey = cacheKey;
+        layers = m_document->createDerivedLayers(transforms, m_fileModel);
+        startPreview(transforms);
     }
 
-    transforms.push_back(t);
-
-    t.setOutput(noteout);
-    
-    transforms.push_back(t);
-
-    std::vector<Layer *> layers =
-        m_document->createDerivedLayers(transforms, m_fileModel);
+    addAnalysisLayers(layers);
+    return "";
+}
 
+void
+Analyser::addAnalysisLayers(const std::vector<Layer *> &layers)
+{
     for (int i = 0; i < (int)layers.size(); ++i) {
 
         FlexiNoteLayer *f = qobject_cast<FlexiNoteLayer *>(layers[i]);
@@ -523,310 +557,1357 @@ Analyser::addAnalyses()
         connect(flexiNoteLayer, SIGNAL(materialiseReAnalysis()),
                 this, SLOT(materialiseReAnalysis()));
     }
-    
-    return "";
 }
 
 void
-Analyser::reAnalyseRegion(sv_frame_t frame0, sv_frame_t frame1, float freq0, float freq1)
+Analyser::startContentHash(QString path, sv_samplerate_t rate,
+                           bool normalised, Transforms transforms)
 {
-    cerr << "Analyser::reAnalyseRegion(" << frame0 << ", " << frame1
-         << ", " << freq0 << ", " << freq1 << ")" << endl;
-    showPitchCandidates(true);
-    (void)reAnalyseSelection(Selection(frame0, frame1),
-                             FrequencyRange(freq0, freq1));
+    int generation = m_hashGeneration;
+
+    QThread *thread = QThread::create
+        ([this, path, rate, normalised, transforms, generation]() {
+            QString key = AnalysisCache::makeKey
+                (AnalysisCache::getContentHash(path),
+                 rate, normalised, transforms);
+            QMetaObject::invokeMethod(this, "contentHashed",
+                                      Qt::QueuedConnection,
+                                      Q_ARG(int, generation),
+                                      Q_ARG(QString, key));
+        });
+
+    m_hashThreads.insert(thread);
+    connect(thread, &QThread::finished, this, [this, thread]() {
+            m_hashThreads.erase(thread);
+            thread->deleteLater();
+        });
+    thread->start();
 }
 
 void
-Analyser::materialiseReAnalysis()
-{
-    if (m_reAnalysingSelection.isEmpty()) return;
-    switchPitchCandidate(m_reAnalysingSelection, true); // or false, doesn't matter
-}
-
-QString
-Analyser::reAnalyseSelection(Selection sel, FrequencyRange range)
+Analyser::contentHashed(int generation, QString key)
 {
-    QMutexLocker locker(&m_asyncMutex);
+    if (generation != m_hashGeneration || key == "") {
+        // The file was closed or the analysis restarted meanwhile
+        return;
+    }
 
-    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
-    if (!waveFileModel) {
-        return "Internal error: Analyser::reAnalyseSelection() called with no model present";
+    if (!m_layers[PitchTrack] || !m_layers[Notes]) {
+        return;
     }
-    
-    if (!m_reAnalysingSelection.isEmpty()) {
-        if (sel == m_reAnalysingSelection && range == m_reAnalysingRange) {
-            cerr << "selection & range are same as current analysis, ignoring" << endl;
-            return "";
-        }
+
+    if (getInitialAnalysisCompletion() >= 100) {
+        // Finished before we knew where to keep it
+        m_pendingCacheKey = key;
+        storeAnalysesInCache();
+        return;
     }
 
-    if (sel.isEmpty()) return "";
+    // The same audio may have been analysed before under a different
+    // name or modification time, in which case we can drop the
+    // analysis in progress in favour of the stored one
 
-    if (m_currentAsyncHandle) {
-        m_document->cancelAsyncLayerCreation(m_currentAsyncHandle);
+    std::vector<Layer *> layers = addCachedAnalyses(key);
+    if (layers.empty()) {
+        m_pendingCacheKey = key;
+        return;
     }
 
-    if (!m_reAnalysisCandidates.empty()) {
-        CommandHistory::getInstance()->startCompoundOperation
-            (tr("Discard Previous Candidates"), true);
-        discardPitchCandidates();
-        CommandHistory::getInstance()->endCompoundOperation();
-    }
+    cerr << "Analyser::contentHashed: replacing analysis in progress "
+         << "with cached result" << endl;
 
-    m_reAnalysingSelection = sel;
-    m_reAnalysingRange = range;
+    stopPreview();
 
-    m_preAnalysis = Clipboard();
-    Layer *myLayer = m_layers[PitchTrack];
-    if (myLayer) {
-        myLayer->copy(m_pane, sel, m_preAnalysis);
+    for (auto c: { PitchTrack, Notes }) {
+        disconnect(m_layers[c], nullptr, this, nullptr);
+        m_document->removeLayerFromView(m_pane, m_layers[c]);
+        m_layers[c] = 0;
     }
 
-    TransformFactory *tf = TransformFactory::getInstance();
-    
-    QString plugname1 = "pYIN";
-    QString plugname2 = "CHP";
+    addAnalysisLayers(layers);
 
-    QString base = "vamp:pyin:localcandidatepyin:";
-    QString out = "pitchtrackcandidates";
+    loadState(PitchTrack);
+    loadState(Notes);
 
-    if (range.isConstrained()) {
-        base = "vamp:chp:constrainedharmonicpeak:";
-        out = "peak";
-    }
+    stackLayers();
 
-    Transforms transforms;
+    emit layersChanged();
+}
 
-    QString notFound = tr("Transform \"%1\" not found. Unable to perform interactive analysis.<br><br>Are the %2 and %3 Vamp plugins correctly installed?");
-    if (!tf->haveTransform(base + out)) {
-	return notFound.arg(base + out).arg(plugname1).arg(plugname2);
+std::vector<Layer *>
+Analyser::addCachedAnalyses(QString cacheKey)
+{
+    AnalysisCache::Result cached;
+    if (!AnalysisCache::load(cacheKey, cached)) {
+        return {};
     }
 
-    Transform t = tf->getDefaultTransformFor
-        (base + out, waveFileModel->getSampleRate());
-    t.setStepSize(256);
-    t.setBlockSize(2048);
+    cerr << "Analyser::addCachedAnalyses: using cached analysis with "
+         << cached.pitches.size() << " pitches and " << cached.notes.size()
+         << " notes" << endl;
 
-    if (range.isConstrained()) {
-        t.setParameter("minfreq", float(range.min));
-        t.setParameter("maxfreq", float(range.max));
-        t.setBlockSize(4096);
-    }
+    // These models are not derived models as far as the document is
+    // concerned, as there is no transform running to generate them,
+    // but they are linked to the audio as their source just as the
+    // derived ones would be
 
-    // get time stamps that align with the 256-sample grid of the original extraction
-    const sv_frame_t grid = 256;
-    sv_frame_t startSample = (sel.getStartFrame() / grid) * grid;
-    if (startSample < sel.getStartFrame()) startSample += grid;
-    sv_frame_t endSample = (sel.getEndFrame() / grid) * grid;
-    if (endSample < sel.getEndFrame()) endSample += grid;
-    if (!range.isConstrained()) {
-        startSample -= 4*grid; // 4*256 is for 4 frames offset due to timestamp shift
-        endSample   -= 4*grid;
-    } else {
-        endSample   -= 9*grid; // MM says: not sure what the CHP plugin does there
+    auto pitchModel = std::make_shared<SparseTimeValueModel>
+        (cached.sampleRate, cached.pitchResolution, false);
+    pitchModel->setScaleUnits("Hz");
+    for (const auto &e: cached.pitches) {
+        pitchModel->add(e);
     }
-    RealTime start = RealTime::frame2RealTime(startSample, waveFileModel->getSampleRate()); 
-    RealTime end = RealTime::frame2RealTime(endSample, waveFileModel->getSampleRate());
+    pitchModel->extendEndFrame(cached.endFrame);
+    pitchModel->setSourceModel(m_fileModel);
+
+    // Filled without notifying, so they must be marked complete, or
+    // they would go on deferring the notifications for later edits
+    // and nothing would repaint
+    pitchModel->setCompletion(100);
+
+    auto noteModel = std::make_shared<NoteModel>
+        (cached.sampleRate, cached.noteResolution, false,
+         NoteModel::FLEXI_NOTE);
+    noteModel->setScaleUnits("Hz");
+    for (const auto &e: cached.notes) {
+        noteModel->add(e);
+    }
+    noteModel->extendEndFrame(cached.endFrame);
+    noteModel->setSourceModel(m_fileModel);
+    noteModel->setCompletion(100);
 
-    RealTime duration;
+    ModelId pitchId = ModelById::add(pitchModel);
+    ModelId noteId = ModelById::add(noteModel);
+    m_document->addNonDerivedModel(pitchId);
+    m_document->addNonDerivedModel(noteId);
 
-    if (sel.getEndFrame() > sel.getStartFrame()) {
-        duration = end - start;
-    }
+    Layer *pitchLayer = m_document->createLayer(LayerFactory::TimeValues);
+    m_document->setModel(pitchLayer, pitchId);
 
-    cerr << "Analyser::reAnalyseSelection: start " << start << " end " << end << " original selection start " << sel.getStartFrame() << " end " << sel.getEndFrame() << " duration " << duration << endl;
+    Layer *noteLayer = m_document->createLayer(LayerFactory::FlexiNotes);
+    m_document->setModel(noteLayer, noteId);
 
-    if (duration <= RealTime::zeroTime) {
-        cerr << "Analyser::reAnalyseSelection: duration <= 0, not analysing" << endl;
-        return "";
+    return { pitchLayer, noteLayer };
+}
+
+void
+Analyser::storeAnalysesInCache()
+{
+    QString key = m_pendingCacheKey;
+    m_pendingCacheKey = "";
+
+    if (!m_layers[PitchTrack] || !m_layers[Notes]) {
+        return;
     }
-    
-    t.setStartTime(start);
-    t.setDuration(duration);
 
-    transforms.push_back(t);
-    
-    m_currentAsyncHandle =
-        m_document->createDerivedLayersAsync(transforms, m_fileModel, this);
+    auto pitchModel = ModelById::getAs<SparseTimeValueModel>
+        (m_layers[PitchTrack]->getModel());
+    auto noteModel = ModelById::getAs<NoteModel>
+        (m_layers[Notes]->getModel());
+    if (!pitchModel || !noteModel) {
+        return;
+    }
 
-    return "";
+    AnalysisCache::Result result;
+    result.sampleRate = pitchModel->getSampleRate();
+    result.pitchResolution = pitchModel->getResolution();
+    result.noteResolution = noteModel->getResolution();
+    result.endFrame = pitchModel->getEndFrame();
+    result.pitches = pitchModel->getAllEvents();
+    result.notes = noteModel->getAllEvents();
+
+    AnalysisCache::store(key, result);
 }
 
-bool
-Analyser::arePitchCandidatesShown() const
+sv_frame_t
+Analyser::getPreviewChunkLength() const
 {
-    return m_candidatesVisible;
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) return 0;
+
+    // Long enough that the per-chunk overhead is small, short enough
+    // that the first chunk is ready within about a second
+    const double seconds = 10.0;
+    const sv_frame_t grid = AnalysisParameters::stepSize;
+    sv_frame_t length = sv_frame_t(seconds * waveFileModel->getSampleRate());
+    return std::max((length / grid) * grid, grid);
 }
 
 void
-Analyser::showPitchCandidates(bool shown) 
+Analyser::startPreview(const Transforms &transforms)
 {
-    if (m_candidatesVisible == shown) return;
+    stopPreview();
 
-    foreach (Layer *layer, m_reAnalysisCandidates) {
-        if (shown) {
-            CommandHistory::getInstance()->addCommand
-                (new ShowLayerCommand(m_pane, layer, true,
-                                      tr("Show Pitch Candidates")));
-        } else {
-            CommandHistory::getInstance()->addCommand
-                (new ShowLayerCommand(m_pane, layer, false,
-                                      tr("Hide Pitch Candidates")));
-        }
-    }
+    if (!isProgressiveAnalysisMode()) return;
 
-    m_candidatesVisible = shown;
+    // The full analysis produces nothing to look at until pYIN has
+    // decoded the whole file. Meanwhile we analyse the file again in
+    // short chunks, starting with whichever is nearest the middle of
+    // the pane at the time, and show the results as a preview until
+    // the full analysis is complete.
+    
+    m_previewTransforms = transforms;
+    schedulePreviewChunk();
 }
 
 void
-Analyser::layersCreated(Document::LayerCreationAsyncHandle handle,
-                        vector<Layer *> primary,
-                        vector<Layer *> additional)
+Analyser::schedulePreviewChunk()
 {
-    {
-        QMutexLocker locker(&m_asyncMutex);
-
-        if (handle != m_currentAsyncHandle || 
-            m_reAnalysingSelection == Selection()) {
-            // We don't want these!
-            for (int i = 0; i < (int)primary.size(); ++i) {
-                m_document->deleteLayer(primary[i]);
-            }
-            for (int i = 0; i < (int)additional.size(); ++i) {
-                m_document->deleteLayer(additional[i]);
-            }
-            return;
-        }
-        m_currentAsyncHandle = 0;
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel || m_previewTransforms.empty() || !m_pane) {
+        return;
+    }
 
-        CommandHistory::getInstance()->startCompoundOperation
-            (tr("Re-Analyse Selection"), true);
+    // Each preview chunk is work done twice, once for the preview and
+    // again by the full analysis running alongside it. Once the full
+    // analysis is past the middle of the file it will be done before
+    // a preview of the rest could be, so we stop there and show what
+    // we have until it is
 
-        m_reAnalysisCandidates.clear();
+    if (getInitialAnalysisCompletion() >= 50) {
+        cerr << "Analyser::schedulePreviewChunk: full analysis is half done, "
+             << "not previewing any further" << endl;
+        m_previewChunk = -1;
+        return;
+    }
 
-        vector<Layer *> all;
-        for (int i = 0; i < (int)primary.size(); ++i) {
-            all.push_back(primary[i]);
-        }
-        for (int i = 0; i < (int)additional.size(); ++i) {
-            all.push_back(additional[i]);
-        }
+    sv_frame_t chunkLength = getPreviewChunkLength();
+    sv_frame_t end = waveFileModel->getEndFrame();
+    int chunks = int((end + chunkLength - 1) / chunkLength);
 
-        for (int i = 0; i < (int)all.size(); ++i) {
-            TimeValueLayer *t = qobject_cast<TimeValueLayer *>(all[i]);
-            if (t) {
-                auto params = t->getPlayParameters();
-                if (params) {
-                    params->setPlayAudible(false);
-                }
-                t->setBaseColour
-                    (ColourDatabase::getInstance()->getColourIndex(tr("Bright Orange")));
-                t->setPresentationName("candidate");
-                m_document->addLayerToView(m_pane, t);
-                m_reAnalysisCandidates.push_back(t);
-                /*
-                cerr << "New re-analysis candidate model has "
-                     << ((SparseTimeValueModel *)t->getModel())->getAllEvents().size() << " point(s)" << endl;
-                */
+    // Take the chunk nearest the middle of the visible range, so that
+    // we follow the user if they scroll while the preview is filling
+    
+    sv_frame_t centre = (m_pane->getFirstVisibleFrame() +
+                         m_pane->getLastVisibleFrame()) / 2;
+    int c = int(std::max(sv_frame_t(0), std::min(centre, end - 1)) /
+                chunkLength);
+
+    int next = -1;
+    for (int d = 0; d < chunks && next < 0; ++d) {
+        for (int candidate: { c + d, c - d }) {
+            if (candidate >= 0 && candidate < chunks &&
+                m_previewChunksDone.find(candidate) ==
+                m_previewChunksDone.end()) {
+                next = candidate;
+                break;
             }
         }
+    }
 
-        if (!all.empty()) {
-            bool show = m_candidatesVisible;
-            m_candidatesVisible = !show; // to ensure the following takes effect
-            showPitchCandidates(show);
-        }
-
-        CommandHistory::getInstance()->endCompoundOperation();
+    if (next < 0) {
+        cerr << "Analyser::schedulePreviewChunk: preview is complete" << endl;
+        m_previewChunk = -1;
+        return;
     }
 
-    emit layersChanged();
-}
+    // Each chunk is analysed with an overlap either side, and only the
+    // middle part is kept, so that the HMM smoothing has settled by
+    // the time it reaches the seam between neighbouring chunks
+    
+    const sv_frame_t overlap = chunkLength / 5;
+    sv_frame_t start = std::max(sv_frame_t(0), next * chunkLength - overlap);
+    sv_frame_t stop = std::min(end, (next + 1) * chunkLength + overlap);
 
-bool
-Analyser::haveHigherPitchCandidate() const
-{
-    if (m_reAnalysisCandidates.empty()) return false;
-    return (m_currentCandidate < 0 ||
-            (m_currentCandidate + 1 < (int)m_reAnalysisCandidates.size()));
-}    
+    sv_samplerate_t rate = waveFileModel->getSampleRate();
+    RealTime startTime = RealTime::frame2RealTime(start, rate);
+    RealTime duration = RealTime::frame2RealTime(stop, rate) - startTime;
+    
+    Transforms transforms = m_previewTransforms;
+    for (auto &t: transforms) {
+        t.setStartTime(startTime);
+        t.setDuration(duration);
+    }
 
-bool
-Analyser::haveLowerPitchCandidate() const
-{
-    if (m_reAnalysisCandidates.empty()) return false;
-    return (m_currentCandidate < 0 || m_currentCandidate >= 1);
-}    
+    QMutexLocker locker(&m_asyncMutex);
+    
+    m_previewChunk = next;
+    m_previewAsyncHandle =
+        m_document->createDerivedLayersAsync(transforms, m_fileModel, this);
+}
 
 void
-Analyser::switchPitchCandidate(Selection sel, bool up)
+Analyser::previewCompletionChanged(ModelId)
 {
-    if (m_reAnalysisCandidates.empty()) return;
+    if (m_previewChunkLayers.empty() || m_previewHarvestPending) {
+        return;
+    }
 
-    if (up) {
-        m_currentCandidate = m_currentCandidate + 1;
-        if (m_currentCandidate >= (int)m_reAnalysisCandidates.size()) {
-            m_currentCandidate = 0;
-        }
-    } else {
-        m_currentCandidate = m_currentCandidate - 1;
-        if (m_currentCandidate < 0) {
-            m_currentCandidate = (int)m_reAnalysisCandidates.size() - 1;
+    for (auto layer: m_previewChunkLayers) {
+        auto model = ModelById::get(layer->getModel());
+        if (model && !model->isReady()) {
+            return;
         }
     }
 
-    Layer *pitchTrack = m_layers[PitchTrack];
-    if (!pitchTrack) return;
-
-    Clipboard clip;
-    pitchTrack->deleteSelection(sel);
-    m_reAnalysisCandidates[m_currentCandidate]->copy(m_pane, sel, clip);
-    pitchTrack->paste(m_pane, clip, 0, false);
-
-    stackLayers();
+    // We are probably being called from a signal emitted by one of
+    // the layers we are about to delete, so do it afterwards
+    m_previewHarvestPending = true;
+    QMetaObject::invokeMethod(this, "harvestPreviewChunk",
+                              Qt::QueuedConnection);
 }
 
 void
-Analyser::stackLayers()
+Analyser::harvestPreviewChunk()
 {
-    // raise the pitch track, then notes on top (if present)
-    if (m_layers[PitchTrack]) {
-        m_paneStack->setCurrentLayer(m_pane, m_layers[PitchTrack]);
-    }
-    if (m_layers[Notes] && !m_layers[Notes]->isLayerDormant(m_pane)) {
-        m_paneStack->setCurrentLayer(m_pane, m_layers[Notes]);
+    m_previewHarvestPending = false;
+
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel || m_previewChunk < 0 || m_previewChunkLayers.empty()) {
+        // preview was stopped or restarted since we were scheduled
+        return;
     }
-}
 
-void
-Analyser::shiftOctave(Selection sel, bool up)
-{
-    float factor = (up ? 2.f : 0.5f);
-    
-    vector<Layer *> actOn;
+    sv_frame_t chunkLength = getPreviewChunkLength();
+    sv_frame_t coreStart = m_previewChunk * chunkLength;
 
-    Layer *pitchTrack = m_layers[PitchTrack];
-    if (pitchTrack) actOn.push_back(pitchTrack);
+    if (!m_previewPitchLayer || !m_previewNoteLayer) {
 
-    foreach (Layer *layer, actOn) {
+        // Created on the first harvest, so that nothing appears until
+        // there is something to show. These are added to the pane
+        // directly rather than through the document, so that they do
+        // not appear in the undo history.
         
-        Clipboard clip;
-        layer->copy(m_pane, sel, clip);
-        layer->deleteSelection(sel);
-
-        Clipboard shifted;
-        foreach (Event e, clip.getPoints()) {
-            if (e.hasValue()) {
-                Event se = e.withValue(e.getValue() * factor);
-                shifted.addPoint(se);
-            } else {
-                shifted.addPoint(e);
+        sv_samplerate_t rate = waveFileModel->getSampleRate();
+        const int resolution = AnalysisParameters::stepSize;
+        ColourDatabase *cdb = ColourDatabase::getInstance();
+
+        auto pitchModel = std::make_shared<SparseTimeValueModel>
+            (rate, resolution, true);
+        pitchModel->setScaleUnits("Hz");
+        ModelId pitchId = ModelById::add(pitchModel);
+        m_document->addNonDerivedModel(pitchId);
+        m_previewPitchLayer = m_document->createLayer(LayerFactory::TimeValues);
+        m_document->setModel(m_previewPitchLayer, pitchId);
+        m_previewPitchLayer->setPresentationName(tr("Pitch preview"));
+        
+        auto noteModel = std::make_shared<NoteModel>
+            (rate, resolution, true, NoteModel::FLEXI_NOTE);
+        noteModel->setScaleUnits("Hz");
+        ModelId noteId = ModelById::add(noteModel);
+        m_document->addNonDerivedModel(noteId);
+        m_previewNoteLayer = m_document->createLayer(LayerFactory::FlexiNotes);
+        m_document->setModel(m_previewNoteLayer, noteId);
+        m_previewNoteLayer->setPresentationName(tr("Note preview"));
+
+        for (auto layer: { m_previewPitchLayer, m_previewNoteLayer }) {
+            SingleColourLayer *scl = qobject_cast<SingleColourLayer *>(layer);
+            if (scl) {
+                scl->setBaseColour(cdb->getColourIndex
+                                   (layer == m_previewPitchLayer ?
+                                    tr("Black") : tr("Bright Blue")));
             }
+            auto params = layer->getPlayParameters();
+            if (params) {
+                params->setPlayAudible(false);
+            }
+            m_pane->addLayer(layer);
         }
-        
-        layer->paste(m_pane, shifted, 0, false);
     }
+
+    auto previewPitch = ModelById::getAs<SparseTimeValueModel>
+        (m_previewPitchLayer->getModel());
+    auto previewNotes = ModelById::getAs<NoteModel>
+        (m_previewNoteLayer->getModel());
+
+    // Keep only what starts within the chunk's own range. A note that
+    // straddles a seam is taken from the chunk it starts in, which is
+    // good enough for a preview that the full analysis will replace.
+    
+    for (auto layer: m_previewChunkLayers) {
+        auto pitch = ModelById::getAs<SparseTimeValueModel>(layer->getModel());
+        if (pitch && previewPitch) {
+            for (const auto &e: pitch->getEventsStartingWithin
+                     (coreStart, chunkLength)) {
+                previewPitch->add(e);
+            }
+        }
+        auto notes = ModelById::getAs<NoteModel>(layer->getModel());
+        if (notes && previewNotes) {
+            for (const auto &e: notes->getEventsStartingWithin
+                     (coreStart, chunkLength)) {
+                previewNotes->add(e);
+            }
+        }
+        m_document->deleteLayer(layer, true);
+    }
+
+    m_previewChunkLayers.clear();
+    m_previewChunksDone.insert(m_previewChunk);
+
+    schedulePreviewChunk();
+}
+
+void
+Analyser::stopPreview()
+{
+    QMutexLocker locker(&m_asyncMutex);
+
+    if (m_previewAsyncHandle) {
+        m_document->cancelAsyncLayerCreation(m_previewAsyncHandle);
+        m_previewAsyncHandle = 0;
+    }
+
+    for (auto layer: m_previewChunkLayers) {
+        m_document->deleteLayer(layer, true);
+    }
+    m_previewChunkLayers.clear();
+
+    for (auto layer: { m_previewPitchLayer, m_previewNoteLayer }) {
+        if (layer) {
+            m_pane->removeLayer(layer);
+            m_document->deleteLayer(layer, true);
+        }
+    }
+    m_previewPitchLayer = 0;
+    m_previewNoteLayer = 0;
+    
+    m_previewTransforms.clear();
+    m_previewChunksDone.clear();
+    m_previewChunk = -1;
+}
+
+void
+Analyser::reAnalyseRegion(sv_frame_t frame0, sv_frame_t frame1, float freq0, float freq1)
+{
+    cerr << "Analyser::reAnalyseRegion(" << frame0 << ", " << frame1
+         << ", " << freq0 << ", " << freq1 << ")" << endl;
+    showPitchCandidates(true);
+    (void)reAnalyseSelection(Selection(frame0, frame1),
+                             FrequencyRange(freq0, freq1));
+}
+
+void
+Analyser::materialiseReAnalysis()
+{
+    if (m_reAnalysingSelection.isEmpty()) return;
+    switchPitchCandidate(m_reAnalysingSelection, true); // or false, doesn't matter
+}
+
+QString
+Analyser::reAnalyseSelection(Selection sel, FrequencyRange range)
+{
+    QMutexLocker locker(&m_asyncMutex);
+
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) {
+        return "Internal error: Analyser::reAnalyseSelection() called with no model present";
+    }
+    
+    if (!m_reAnalysingSelection.isEmpty()) {
+        if (sel == m_reAnalysingSelection && range == m_reAnalysingRange) {
+            cerr << "selection & range are same as current analysis, ignoring" << endl;
+            return "";
+        }
+    }
+
+    if (sel.isEmpty()) return "";
+
+    if (m_currentAsyncHandle) {
+        m_document->cancelAsyncLayerCreation(m_currentAsyncHandle);
+        m_currentAsyncHandle = 0;
+    }
+
+    if (m_candidateLayer || !m_candidateOverlay.isEmpty()) {
+        discardPitchCandidates();
+    }
+
+    m_reAnalysingSelection = sel;
+    m_reAnalysingRange = range;
+
+    Layer *myLayer = m_layers[PitchTrack];
+    auto myModel = myLayer ?
+        ModelById::getAs<SparseTimeValueModel>(myLayer->getModel()) : nullptr;
+    if (myModel) {
+        m_preAnalysis.push(sel.getStartFrame(), sel.getEndFrame(),
+                           myModel->getEventsStartingWithin
+                           (sel.getStartFrame(), sel.getDuration()));
+    }
+
+    // Pitch candidates for any part of the file analysed already,
+    // whether speculatively or for an earlier selection, are in the
+    // cache. If it has all of this selection we can use them straight
+    // away; otherwise we analyse only the parts it lacks and use the
+    // cache once they are in (see continueReAnalysis)
+
+    if (!range.isConstrained()) {
+
+        if (m_candidateCache.covers(sel.getStartFrame(), sel.getEndFrame())) {
+            cerr << "Analyser::reAnalyseSelection: using cached candidates" << endl;
+            installPitchCandidates
+                (m_candidateCache.slice(sel.getStartFrame(), sel.getEndFrame()));
+            locker.unlock();
+            emit layersChanged();
+            return "";
+        }
+
+        stopSpeculation();
+
+        // A range still being analysed for the previous selection is
+        // kept if this one needs it too, as when a selection is being
+        // dragged out, and abandoned otherwise
+
+        if (m_deltaAsyncHandle || !m_deltaLayers.empty()) {
+            bool wanted = false;
+            for (auto gap: m_candidateCache.missing(sel.getStartFrame(),
+                                                    sel.getEndFrame())) {
+                if (gap.first < m_deltaEnd && gap.second > m_deltaStart) {
+                    wanted = true;
+                    break;
+                }
+            }
+            if (wanted) return "";
+            stopDelta();
+        }
+
+        return startDelta();
+    }
+
+    // The user is waiting for this one, so it takes priority
+    stopSpeculation();
+    stopDelta();
+
+    // The constrained peak search is quick once we have the spectra,
+    // and they are kept between outlines, so we do it here directly
+    // if we can, rather than running the plugin
+
+    CandidateCache::Tracks tracks;
+    if (findConstrainedPeaks(sel, range, tracks)) {
+        installPitchCandidates(tracks);
+        locker.unlock();
+        emit layersChanged();
+        return "";
+    }
+    
+    Transform t;
+    QString error = makeCandidateTransform(sel, range, t);
+    if (error != "" || t.getDuration() <= RealTime::zeroTime) {
+        return error;
+    }
+
+    m_currentAsyncHandle =
+        m_document->createDerivedLayersAsync({ t }, m_fileModel, this);
+
+    return "";
+}
+
+bool
+Analyser::findConstrainedPeaks(Selection sel, FrequencyRange range,
+                               CandidateCache::Tracks &tracks)
+{
+    // Called with m_asyncMutex held
+
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) return false;
+
+    // As used by makeCandidateTransform for the plugin, whose default
+    // number of harmonics we also share
+    const int blockSize = 4096;
+    const int step = AnalysisParameters::stepSize;
+    const int harmonics = 5;
+
+    if (!m_spectrumCache || m_spectrumCache->getAudioModel() != m_fileModel) {
+        m_spectrumCache.reset(new SpectrumCache(m_fileModel, blockSize, step));
+    }
+    if (!m_spectrumCache->isOK()) {
+        return false;
+    }
+
+    int c0 = int((sel.getStartFrame() + step - 1) / step);
+    int c1 = int((sel.getEndFrame() + step - 1) / step);
+
+    HarmonicPeak search(blockSize, waveFileModel->getSampleRate(),
+                        range.min, range.max, harmonics);
+
+    // A batch at a time, each well within what the spectrum cache
+    // holds, so that its columns stay put while we search them
+    const int batch = 256;
+    std::vector<const float *> columns;
+    std::vector<double> peaks(batch);
+    
+    EventVector track;
+    for (int c = c0; c < c1; c += batch) {
+        columns.clear();
+        for (int k = c; k < c1 && k < c + batch; ++k) {
+            const float *mags = m_spectrumCache->getMagnitudes(k);
+            if (!mags) break;
+            columns.push_back(mags);
+        }
+        search.findBatch(columns.data(), int(columns.size()), peaks.data());
+        for (int k = 0; k < int(columns.size()); ++k) {
+            if (peaks[k] > 0.0) {
+                track.push_back(Event(sv_frame_t(c + k) * step,
+                                      float(peaks[k]), ""));
+            }
+        }
+        if (int(columns.size()) < batch) break;
+    }
+
+    tracks.clear();
+    if (!track.empty()) {
+        tracks.push_back(track);
+    }
+    return true;
+}
+
+QString
+Analyser::startDelta()
+{
+    // Called with m_asyncMutex held
+
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) return "";
+    
+    auto gaps = m_candidateCache.missing(m_reAnalysingSelection.getStartFrame(),
+                                         m_reAnalysingSelection.getEndFrame());
+    if (gaps.empty()) return "";
+
+    // The HMM needs some context either side of the range it is
+    // asked about, and a little more of it also means the next small
+    // adjustment to the selection is likely to be covered already
+
+    const sv_frame_t grid = AnalysisParameters::stepSize;
+    sv_frame_t context = sv_frame_t(waveFileModel->getSampleRate());
+    sv_frame_t start = gaps[0].first - context;
+    sv_frame_t end = gaps[0].second + context;
+    start = std::max(sv_frame_t(0), (start / grid) * grid);
+    end = std::min(waveFileModel->getEndFrame(),
+                   ((end + grid - 1) / grid) * grid);
+    
+    Transform t;
+    QString error = makeCandidateTransform
+        (Selection(start, end), FrequencyRange(), t);
+    if (error != "" || t.getDuration() <= RealTime::zeroTime) {
+        return error;
+    }
+
+    cerr << "Analyser::startDelta: analysing candidates from " << start
+         << " to " << end << " (" << gaps.size()
+         << " uncovered range(s) in selection)" << endl;
+
+    m_deltaStart = start;
+    m_deltaEnd = end;
+    m_deltaAsyncHandle =
+        m_document->createDerivedLayersAsync({ t }, m_fileModel, this);
+
+    return "";
+}
+
+void
+Analyser::stopDelta()
+{
+    // Called with m_asyncMutex held
+
+    if (m_deltaAsyncHandle) {
+        m_document->cancelAsyncLayerCreation(m_deltaAsyncHandle);
+        m_deltaAsyncHandle = 0;
+    }
+
+    for (auto layer: m_deltaLayers) {
+        m_document->deleteLayer(layer, true);
+    }
+    m_deltaLayers.clear();
+}
+
+void
+Analyser::deltaCompletionChanged(ModelId)
+{
+    if (m_deltaLayers.empty() || m_deltaHarvestPending) {
+        return;
+    }
+    if (!areCandidateLayersReady(m_deltaLayers)) {
+        return;
+    }
+    m_deltaHarvestPending = true;
+    QMetaObject::invokeMethod(this, "harvestDelta", Qt::QueuedConnection);
+}
+
+void
+Analyser::harvestDelta()
+{
+    m_deltaHarvestPending = false;
+
+    {
+        QMutexLocker locker(&m_asyncMutex);
+        if (m_deltaLayers.empty()) {
+            // abandoned since we were scheduled
+            return;
+        }
+        m_candidateCache.add(m_deltaStart, m_deltaEnd,
+                             takeCandidateTracks(m_deltaLayers));
+    }
+
+    continueReAnalysis();
+}
+
+void
+Analyser::continueReAnalysis()
+{
+    {
+        QMutexLocker locker(&m_asyncMutex);
+
+        Selection sel = m_reAnalysingSelection;
+        
+        if (!sel.isEmpty() && !m_reAnalysingRange.isConstrained() &&
+            m_candidateOverlay.isEmpty()) {
+
+            if (!m_candidateCache.covers(sel.getStartFrame(),
+                                         sel.getEndFrame())) {
+                QString error = startDelta();
+                if (error != "") {
+                    cerr << "Analyser::continueReAnalysis: " << error << endl;
+                }
+                if (m_deltaAsyncHandle) return;
+            } else {
+                installPitchCandidates
+                    (m_candidateCache.slice(sel.getStartFrame(),
+                                            sel.getEndFrame()));
+                locker.unlock();
+                emit layersChanged();
+            }
+        }
+    }
+
+    // The speculation was held back while this was running
+    m_speculationTimer->start();
+}
+
+QString
+Analyser::makeCandidateTransform(Selection sel, FrequencyRange range,
+                                 Transform &t) const
+{
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) {
+        return "Internal error: Analyser::makeCandidateTransform() called with no model present";
+    }
+    
+    TransformFactory *tf = TransformFactory::getInstance();
+    
+    QString plugname1 = "pYIN";
+    QString plugname2 = "CHP";
+
+    QString base = "vamp:pyin:localcandidatepyin:";
+    QString out = "pitchtrackcandidates";
+
+    if (range.isConstrained()) {
+        base = "vamp:chp:constrainedharmonicpeak:";
+        out = "peak";
+    }
+
+    QString notFound = tr("Transform \"%1\" not found. Unable to perform interactive analysis.<br><br>Are the %2 and %3 Vamp plugins correctly installed?");
+    if (!tf->haveTransform(base + out)) {
+	return notFound.arg(base + out).arg(plugname1).arg(plugname2);
+    }
+
+    t = tf->getDefaultTransformFor
+        (base + out, waveFileModel->getSampleRate());
+    t.setStepSize(256);
+    t.setBlockSize(2048);
+
+    if (range.isConstrained()) {
+        t.setParameter("minfreq", float(range.min));
+        t.setParameter("maxfreq", float(range.max));
+        t.setBlockSize(4096);
+    }
+
+    // An empty selection means the whole file, which needs no start
+    // time or duration
+    if (sel.isEmpty()) {
+        return "";
+    }
+    
+    // We want outputs at exactly the frames of the 256-sample grid
+    // of the original extraction that lie within the selection, so we
+    // ask for the blocks whose outputs will be stamped with those
+    const sv_frame_t grid = 256;
+    sv_frame_t startSample = (sel.getStartFrame() / grid) * grid;
+    if (startSample < sel.getStartFrame()) startSample += grid;
+    sv_frame_t endSample = (sel.getEndFrame() / grid) * grid;
+    if (endSample < sel.getEndFrame()) endSample += grid;
+    sv_frame_t latency = getCandidateOutputLatency(t);
+    startSample -= latency;
+    endSample -= latency;
+    RealTime start = RealTime::frame2RealTime(startSample, waveFileModel->getSampleRate()); 
+    RealTime end = RealTime::frame2RealTime(endSample, waveFileModel->getSampleRate());
+
+    RealTime duration;
+
+    if (sel.getEndFrame() > sel.getStartFrame()) {
+        duration = end - start;
+    }
+
+    cerr << "Analyser::makeCandidateTransform: start " << start << " end " << end << " original selection start " << sel.getStartFrame() << " end " << sel.getEndFrame() << " duration " << duration << endl;
+
+    if (duration <= RealTime::zeroTime) {
+        cerr << "Analyser::makeCandidateTransform: duration <= 0, not analysing" << endl;
+    }
+    
+    t.setStartTime(start);
+    t.setDuration(duration);
+
+    return "";
+}
+
+sv_frame_t
+Analyser::getCandidateOutputLatency(const Transform &t)
+{
+    // Local candidate pYIN works in the time domain and stamps each
+    // estimate with the centre of the block it came from, half a
+    // block after the block's own timestamp. Frequency-domain plugins
+    // such as CHP are already given blocks centred on their
+    // timestamps by the host, so their outputs need no correction
+    
+    if (t.getPluginIdentifier() == "vamp:pyin:localcandidatepyin") {
+        return t.getBlockSize() / 2;
+    }
+    return 0;
+}
+
+sv_frame_t
+Analyser::getSpeculationWindowLength() const
+{
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) return 0;
+
+    // About as long as a phrase, so that most selections fall within
+    // one window, and short enough to be quick to analyse
+    const double seconds = 10.0;
+    const sv_frame_t grid = AnalysisParameters::stepSize;
+    sv_frame_t length = sv_frame_t(seconds * waveFileModel->getSampleRate());
+    return std::max((length / grid) * grid, grid);
+}
+
+bool
+Analyser::getSpeculationWindow(int window,
+                               sv_frame_t &start, sv_frame_t &end) const
+{
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel || window < 0) return false;
+
+    // Windows are laid out on a fixed grid, so that moving around
+    // within one does not cause it to be analysed again, and each
+    // extends some way into its neighbours, so that a selection
+    // across the boundary between two is still covered by one of them
+
+    sv_frame_t length = getSpeculationWindowLength();
+    sv_frame_t overlap = length / 5;
+    sv_frame_t fileEnd = waveFileModel->getEndFrame();
+
+    start = window * length - overlap;
+    end = (window + 1) * length + overlap;
+    if (start >= fileEnd) return false;
+
+    // Selections are most often of a single note, so we avoid cutting
+    // through one at either end
+
+    Layer *notes = m_layers.count(Notes) ? m_layers.at(Notes) : nullptr;
+    auto noteModel = notes ?
+        ModelById::getAs<NoteModel>(notes->getModel()) : nullptr;
+    if (noteModel) {
+        for (const auto &e: noteModel->getEventsCovering(start)) {
+            start = std::min(start, e.getFrame());
+        }
+        for (const auto &e: noteModel->getEventsCovering(end)) {
+            end = std::max(end, e.getFrame() + e.getDuration());
+        }
+    }
+
+    const sv_frame_t grid = AnalysisParameters::stepSize;
+    start = std::max(sv_frame_t(0), (start / grid) * grid);
+    end = std::min(fileEnd, ((end + grid - 1) / grid) * grid);
+    return end > start;
+}
+
+void
+Analyser::navigatedTo(sv_frame_t frame)
+{
+    m_speculationFrame = frame;
+    if (!m_speculationTimer->isActive()) {
+        m_speculationTimer->start();
+    }
+}
+
+void
+Analyser::speculate()
+{
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    bool speculative = settings.value("speculative-candidates", true).toBool();
+    settings.endGroup();
+
+    if (!(speculative || isWholeFileCandidateMode()) ||
+        !m_document || !m_pane) {
+        return;
+    }
+
+    // The initial analysis and any re-analysis the user has asked for
+    // come first; we get going again once they are done
+    
+    if (getInitialAnalysisCompletion() < 100) return;
+
+    QMutexLocker locker(&m_asyncMutex);
+
+    if (m_currentAsyncHandle || m_speculationAsyncHandle ||
+        !m_speculationLayers.empty() ||
+        m_deltaAsyncHandle || !m_deltaLayers.empty()) {
+        return;
+    }
+
+    // In whole-file mode there is just the one analysis to do, after
+    // which every selection is covered
+    
+    if (isWholeFileCandidateMode()) {
+        if (m_candidateCache.hasWholeFile()) return;
+        Transform t;
+        if (makeCandidateTransform(Selection(), FrequencyRange(), t) != "") {
+            return;
+        }
+        cerr << "Analyser::speculate: analysing candidates for whole file"
+             << endl;
+        m_speculationWholeFile = true;
+        m_speculationAsyncHandle =
+            m_document->createDerivedLayersAsync({ t }, m_fileModel, this);
+        return;
+    }
+
+    sv_frame_t length = getSpeculationWindowLength();
+    if (length <= 0) return;
+    int here = int(m_speculationFrame / length);
+
+    // The window the user is in, then the one they are most likely
+    // to move into next
+
+    for (int window: { here, here + 1, here - 1 }) {
+
+        sv_frame_t start = 0, end = 0;
+        if (!getSpeculationWindow(window, start, end) ||
+            m_candidateCache.covers(start, end)) {
+            continue;
+        }
+
+        Transform t;
+        QString error = makeCandidateTransform
+            (Selection(start, end), FrequencyRange(), t);
+        if (error != "" || t.getDuration() <= RealTime::zeroTime) {
+            return;
+        }
+
+        cerr << "Analyser::speculate: analysing candidates from " << start
+             << " to " << end << endl;
+
+        m_speculationWholeFile = false;
+        m_speculationStart = start;
+        m_speculationEnd = end;
+        m_speculationAsyncHandle =
+            m_document->createDerivedLayersAsync({ t }, m_fileModel, this);
+        return;
+    }
+}
+
+void
+Analyser::speculationCompletionChanged(ModelId)
+{
+    if (m_speculationLayers.empty() || m_speculationHarvestPending) {
+        return;
+    }
+    if (!areCandidateLayersReady(m_speculationLayers)) {
+        return;
+    }
+
+    // As for the preview, we may be called from a signal emitted by
+    // one of the layers we are about to delete
+    m_speculationHarvestPending = true;
+    QMetaObject::invokeMethod(this, "harvestSpeculation",
+                              Qt::QueuedConnection);
+}
+
+void
+Analyser::harvestSpeculation()
+{
+    m_speculationHarvestPending = false;
+
+    if (m_speculationLayers.empty()) {
+        // speculation was stopped since we were scheduled
+        return;
+    }
+
+    CandidateCache::Tracks tracks = takeCandidateTracks(m_speculationLayers);
+
+    if (m_speculationWholeFile) {
+        m_candidateCache.setWholeFile(tracks);
+        cerr << "Analyser::harvestSpeculation: whole-file candidate index "
+             << "has " << tracks.size() << " track(s)" << endl;
+    } else {
+        m_candidateCache.add(m_speculationStart, m_speculationEnd, tracks);
+    }
+
+    // And on to the next window, if there is one still to do
+    speculate();
+}
+
+bool
+Analyser::areCandidateLayersReady(const vector<Layer *> &layers) const
+{
+    for (auto layer: layers) {
+        auto model = ModelById::get(layer->getModel());
+        if (model && !model->isReady()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CandidateCache::Tracks
+Analyser::takeCandidateTracks(vector<Layer *> &layers)
+{
+    CandidateCache::Tracks tracks;
+    
+    for (auto layer: layers) {
+        auto model = ModelById::getAs<SparseTimeValueModel>(layer->getModel());
+        if (model) {
+            EventVector events = model->getAllEvents();
+            if (!events.empty()) {
+                tracks.push_back(events);
+            }
+        }
+        m_document->deleteLayer(layer, true);
+    }
+    layers.clear();
+
+    return tracks;
+}
+
+bool
+Analyser::isProgressiveAnalysisMode()
+{
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    bool progressive = settings.value(getProgressiveAnalysisKey(), true).toBool();
+    settings.endGroup();
+    return progressive;
+}
+
+bool
+Analyser::isWholeFileCandidateMode()
+{
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    bool whole = settings.value(getWholeFileCandidatesKey(), false).toBool();
+    settings.endGroup();
+    return whole;
+}
+
+void
+Analyser::stopSpeculation()
+{
+    // Called with m_asyncMutex held
+    
+    // The whole-file analysis is too long to throw away, and once it
+    // is done the user will not have to wait again, so we let it be
+
+    if (m_speculationWholeFile &&
+        (m_speculationAsyncHandle || !m_speculationLayers.empty())) {
+        return;
+    }
+    
+    if (m_speculationAsyncHandle) {
+        m_document->cancelAsyncLayerCreation(m_speculationAsyncHandle);
+        m_speculationAsyncHandle = 0;
+    }
+
+    for (auto layer: m_speculationLayers) {
+        m_document->deleteLayer(layer, true);
+    }
+    m_speculationLayers.clear();
+
+    // Take up where we left off, once the user's analysis is done
+    if (m_pane) {
+        m_speculationFrame = m_pane->getCentreFrame();
+    }
+}
+
+bool
+Analyser::arePitchCandidatesShown() const
+{
+    return m_candidatesVisible;
+}
+
+void
+Analyser::showPitchCandidates(bool shown) 
+{
+    if (m_candidatesVisible == shown) return;
+
+    m_candidatesVisible = shown;
+
+    if (m_candidateLayer) {
+        m_candidateLayer->setLayerDormant(m_pane, !shown);
+        m_pane->layerParametersChanged();
+    }
+}
+
+void
+Analyser::layersCreated(Document::LayerCreationAsyncHandle handle,
+                        vector<Layer *> primary,
+                        vector<Layer *> additional)
+{
+    {
+        QMutexLocker locker(&m_asyncMutex);
+
+        if (handle && handle == m_previewAsyncHandle) {
+            m_previewAsyncHandle = 0;
+            m_previewChunkLayers = primary;
+            for (auto layer: additional) {
+                m_previewChunkLayers.push_back(layer);
+            }
+            for (auto layer: m_previewChunkLayers) {
+                connect(layer, SIGNAL(modelCompletionChanged(ModelId)),
+                        this, SLOT(previewCompletionChanged(ModelId)));
+            }
+            // in case they were complete before we connected
+            previewCompletionChanged({});
+            return;
+        }
+
+        if (handle && handle == m_speculationAsyncHandle) {
+            m_speculationAsyncHandle = 0;
+            m_speculationLayers = primary;
+            for (auto layer: additional) {
+                m_speculationLayers.push_back(layer);
+            }
+            for (auto layer: m_speculationLayers) {
+                connect(layer, SIGNAL(modelCompletionChanged(ModelId)),
+                        this, SLOT(speculationCompletionChanged(ModelId)));
+            }
+            speculationCompletionChanged({});
+            return;
+        }
+
+        if (handle && handle == m_deltaAsyncHandle) {
+            m_deltaAsyncHandle = 0;
+            m_deltaLayers = primary;
+            for (auto layer: additional) {
+                m_deltaLayers.push_back(layer);
+            }
+            for (auto layer: m_deltaLayers) {
+                connect(layer, SIGNAL(modelCompletionChanged(ModelId)),
+                        this, SLOT(deltaCompletionChanged(ModelId)));
+            }
+            deltaCompletionChanged({});
+            return;
+        }
+
+        if (handle != m_currentAsyncHandle || 
+            m_reAnalysingSelection == Selection()) {
+            // We don't want these!
+            for (int i = 0; i < (int)primary.size(); ++i) {
+                m_document->deleteLayer(primary[i]);
+            }
+            for (int i = 0; i < (int)additional.size(); ++i) {
+                m_document->deleteLayer(additional[i]);
+            }
+            return;
+        }
+        m_currentAsyncHandle = 0;
+
+        vector<Layer *> all;
+        for (int i = 0; i < (int)primary.size(); ++i) {
+            all.push_back(primary[i]);
+        }
+        for (int i = 0; i < (int)additional.size(); ++i) {
+            all.push_back(additional[i]);
+        }
+
+        // Outputs are requested for the selection only (see
+        // makeCandidateTransform), but a plugin may pad its last block
+        CandidateCache::Tracks tracks;
+        for (auto &track: takeCandidateTracks(all)) {
+            EventVector within;
+            for (const auto &e: track) {
+                if (e.getFrame() >= m_reAnalysingSelection.getStartFrame() &&
+                    e.getFrame() < m_reAnalysingSelection.getEndFrame()) {
+                    within.push_back(e);
+                }
+            }
+            if (!within.empty()) {
+                tracks.push_back(within);
+            }
+        }
+        
+        installPitchCandidates(tracks);
+    }
+
+    emit layersChanged();
+
+    // The speculation was held back while this was running
+    m_speculationTimer->start();
+}
+
+void
+Analyser::installPitchCandidates(const CandidateCache::Tracks &tracks)
+{
+    auto waveFileModel = ModelById::getAs<WaveFileModel>(m_fileModel);
+    if (!waveFileModel) return;
+
+    m_candidateOverlay.set(tracks);
+    m_currentCandidate = -1;
+
+    // All of the candidates are shown together, as points, in a
+    // single layer that belongs to us rather than to the document's
+    // undo history: the layer is added to the pane directly, and
+    // replaced along with the candidates
+
+    if (m_candidateLayer) {
+        m_pane->removeLayer(m_candidateLayer);
+        m_document->deleteLayer(m_candidateLayer, true);
+        m_candidateLayer = 0;
+    }
+
+    if (m_candidateOverlay.isEmpty()) return;
+    
+    auto model = std::make_shared<SparseTimeValueModel>
+        (waveFileModel->getSampleRate(), AnalysisParameters::stepSize, false);
+    model->setScaleUnits("Hz");
+    for (int i = 0; i < m_candidateOverlay.getPointCount(); ++i) {
+        model->add(Event(m_candidateOverlay.getFrame(i),
+                         m_candidateOverlay.getPitch(i), ""));
+    }
+    model->setSourceModel(m_fileModel);
+    model->setCompletion(100);
+
+    ModelId id = ModelById::add(model);
+    m_document->addNonDerivedModel(id);
+
+    TimeValueLayer *t = qobject_cast<TimeValueLayer *>
+        (m_document->createLayer(LayerFactory::TimeValues));
+    if (!t) return;
+    m_document->setModel(t, id);
+    
+    auto params = t->getPlayParameters();
+    if (params) {
+        params->setPlayAudible(false);
+    }
+    t->setPlotStyle(TimeValueLayer::PlotPoints);
+    t->setBaseColour
+        (ColourDatabase::getInstance()->getColourIndex(tr("Bright Orange")));
+    // FlexiNoteLayer looks for its pitch track among the pane's
+    // time-value layers, skipping any with this name, so it must stay
+    // as it was before the candidates were merged into one layer
+    t->setPresentationName("candidate");
+    t->setLayerDormant(m_pane, !m_candidatesVisible);
+    m_pane->addLayer(t);
+    m_candidateLayer = t;
+
+    stackLayers();
+}
+
+bool
+Analyser::haveHigherPitchCandidate() const
+{
+    int n = m_candidateOverlay.getTrackCount();
+    if (n == 0) return false;
+    return (m_currentCandidate < 0 || m_currentCandidate + 1 < n);
+}    
+
+bool
+Analyser::haveLowerPitchCandidate() const
+{
+    if (m_candidateOverlay.getTrackCount() == 0) return false;
+    return (m_currentCandidate < 0 || m_currentCandidate >= 1);
+}    
+
+void
+Analyser::switchPitchCandidate(Selection sel, bool up)
+{
+    MultiSelection::SelectionList selections;
+    selections.insert(sel);
+    (void)switchPitchCandidates(selections, up);
+}
+
+vector<Selection>
+Analyser::switchPitchCandidates(const MultiSelection::SelectionList &selections,
+                                bool up)
+{
+    int n = m_candidateOverlay.getTrackCount();
+    if (n == 0 || selections.empty()) return {};
+
+    if (up) {
+        m_currentCandidate = m_currentCandidate + 1;
+        if (m_currentCandidate >= n) {
+            m_currentCandidate = 0;
+        }
+    } else {
+        m_currentCandidate = m_currentCandidate - 1;
+        if (m_currentCandidate < 0) {
+            m_currentCandidate = n - 1;
+        }
+    }
+
+    Layer *pitchTrack = m_layers[PitchTrack];
+    if (!pitchTrack) return {};
+
+    // Selections are in order of start frame; any that overlap or
+    // touch are treated as one region, so that no pitch is removed
+    // or added twice
+    
+    vector<Selection> regions;
+    for (const auto &sel: selections) {
+        if (!regions.empty() &&
+            sel.getStartFrame() <= regions.rbegin()->getEndFrame()) {
+            Selection &last = *regions.rbegin();
+            last = Selection(last.getStartFrame(),
+                             std::max(last.getEndFrame(), sel.getEndFrame()));
+        } else {
+            regions.push_back(sel);
+        }
+    }
+
+    // This is the only part of re-analysis that goes into the undo
+    // history, as one edit to the pitch track covering all regions
+
+    RegionEdit edit(pitchTrack->getModel(),
+                    up ? tr("Choose Higher Pitch Candidate") :
+                    tr("Choose Lower Pitch Candidate"));
+
+    for (const auto &r: regions) {
+        edit.replace(r.getStartFrame(), r.getEndFrame(),
+                     m_candidateOverlay.getTrack
+                     (m_currentCandidate, r.getStartFrame(), r.getEndFrame()));
+    }
+
+    edit.commit();
+
+    stackLayers();
+
+    return regions;
+}
+
+void
+Analyser::stackLayers()
+{
+    // raise the pitch track, then notes on top (if present)
+    if (m_layers[PitchTrack]) {
+        m_paneStack->setCurrentLayer(m_pane, m_layers[PitchTrack]);
+    }
+    if (m_layers[Notes] && !m_layers[Notes]->isLayerDormant(m_pane)) {
+        m_paneStack->setCurrentLayer(m_pane, m_layers[Notes]);
+    }
+}
+
+void
+Analyser::shiftOctave(Selection sel, bool up)
+{
+    float factor = (up ? 2.f : 0.5f);
+    
+    Layer *pitchTrack = m_layers[PitchTrack];
+    if (!pitchTrack) return;
+
+    RegionEdit edit(pitchTrack->getModel(),
+                    up ? tr("Octave Up") : tr("Octave Down"));
+    edit.map(sel.getStartFrame(), sel.getEndFrame(),
+             [factor](const Event &e) {
+                 return e.hasValue() ? e.withValue(e.getValue() * factor) : e;
+             });
+    edit.commit();
 }
 
 void
@@ -847,8 +1928,25 @@ Analyser::abandonReAnalysis(Selection sel)
 
     Layer *myLayer = m_layers[PitchTrack];
     if (!myLayer) return;
-    myLayer->deleteSelection(sel);
-    myLayer->paste(m_pane, m_preAnalysis, 0, false);
+    auto myModel = ModelById::getAs<SparseTimeValueModel>(myLayer->getModel());
+    if (!myModel) return;
+
+    // Back to the state before the most recent re-analysis of this
+    // region, or nothing if the region has not changed since then (as
+    // when it is selected again after a re-analysis was accepted);
+    // doing this again goes back to the one before that
+
+    EventVector restored;
+    if (!m_preAnalysis.pop(sel.getStartFrame(), sel.getEndFrame(),
+                           myModel->getEventsStartingWithin
+                           (sel.getStartFrame(), sel.getDuration()),
+                           restored)) {
+        return;
+    }
+    
+    RegionEdit edit(myLayer->getModel(), tr("Abandon Re-Analysis"));
+    edit.replace(sel.getStartFrame(), sel.getEndFrame(), restored);
+    edit.commit();
 }    
 
 void
@@ -860,16 +1958,15 @@ Analyser::clearReAnalysis()
 void
 Analyser::discardPitchCandidates()
 {
-    if (!m_reAnalysisCandidates.empty()) {
-        // We don't use a compound command here, because we may be
-        // already in one. Caller bears responsibility for doing that
-        foreach (Layer *layer, m_reAnalysisCandidates) {
-            // This will cause the layer to be deleted later (ownership is
-            // transferred to the remove command)
-            m_document->removeLayerFromView(m_pane, layer);
-        }
-        m_reAnalysisCandidates.clear();
+    // The candidates are not in the undo history, so they go
+    // straight away
+
+    if (m_candidateLayer) {
+        m_pane->removeLayer(m_candidateLayer);
+        m_document->deleteLayer(m_candidateLayer, true);
+        m_candidateLayer = 0;
     }
+    m_candidateOverlay.clear();
 
     m_currentCandidate = -1;
     m_reAnalysingSelection = Selection();
@@ -881,15 +1978,9 @@ Analyser::layerAboutToBeDeleted(Layer *doomed)
 {
     cerr << "Analyser::layerAboutToBeDeleted(" << doomed << ")" << endl;
     
-    vector<Layer *> notDoomed;
-
-    foreach (Layer *layer, m_reAnalysisCandidates) {
-        if (layer != doomed) {
-            notDoomed.push_back(layer);
-        }
-    }
-
-    m_reAnalysisCandidates = notDoomed;
+    if (doomed == m_candidateLayer) m_candidateLayer = 0;
+    if (doomed == m_previewPitchLayer) m_previewPitchLayer = 0;
+    if (doomed == m_previewNoteLayer) m_previewNoteLayer = 0;
 }
 
 void
@@ -898,35 +1989,23 @@ Analyser::takePitchTrackFrom(Layer *otherLayer)
     Layer *myLayer = m_layers[PitchTrack];
     if (!myLayer || !otherLayer) return;
 
-    auto myModel = ModelById::get(myLayer->getModel());
-    auto otherModel = ModelById::get(otherLayer->getModel());
-    if (!myModel || !otherModel) return;
-
-    Clipboard clip;
-    
-    Selection sel = Selection(myModel->getStartFrame(),
-                              myModel->getEndFrame());
-    myLayer->deleteSelection(sel);
-
-    sel = Selection(otherModel->getStartFrame(),
-                    otherModel->getEndFrame());
-    otherLayer->copy(m_pane, sel, clip);
+    auto otherModel = ModelById::getAs<SparseTimeValueModel>
+        (otherLayer->getModel());
+    if (!otherModel) return;
 
     // Remove all pitches <= 0Hz -- we now save absent pitches as 0Hz
     // values when exporting a pitch track, so we need to exclude them
     // here when importing again
     EventVector after;
-    int excl = 0;
-    for (const auto &p: clip.getPoints()) {
+    for (const auto &p: otherModel->getAllEvents()) {
         if (p.hasValue() && p.getValue() > 0.f) {
             after.push_back(p);
-        } else {
-            ++excl;
         }
     }
-    clip.setPoints(after);
 
-    myLayer->paste(m_pane, clip, 0, false);
+    RegionEdit edit(myLayer->getModel(), tr("Import Pitch Track"));
+    edit.replaceAll(after);
+    edit.commit();
 }
 
 void
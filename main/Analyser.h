@@ -21,13 +21,23 @@
 #include <QMutex>
 
 #include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
 #include "framework/Document.h"
 #include "base/Selection.h"
-#include "base/Clipboard.h"
+#include "base/Event.h"
 #include "data/model/WaveFileModel.h"
 
+#include "CandidateCache.h"
+#include "CandidateOverlay.h"
+#include "PitchSnapshotStore.h"
+#include "SpectrumCache.h"
+
+class QTimer;
+class QThread;
+
 namespace sv {
 class Pane;
 class PaneStack;
@@ -138,34 +148,67 @@ public:
      */
     QString reAnalyseSelection(sv::Selection sel, FrequencyRange range);
 
+    /**
+     * Return true if pitch candidates are to be found for the whole
+     * file in the background once the initial analysis is complete,
+     * rather than only around the playhead. The setting lives in the
+     * Analyser group in QSettings, and is off by default.
+     */
+    static bool isWholeFileCandidateMode();
+    static QString getWholeFileCandidatesKey() {
+        return "whole-file-candidates";
+    }
+
+    /**
+     * Return true if a preview of the initial analysis is to be built
+     * up a chunk at a time while the full analysis runs. The preview
+     * takes as much CPU again as the analysis it stands in for. The
+     * setting lives in the Analyser group in QSettings, and is on by
+     * default.
+     */
+    static bool isProgressiveAnalysisMode();
+    static QString getProgressiveAnalysisKey() {
+        return "progressive-analysis";
+    }
+
     /**
      * Return true if the analysed pitch candidates are currently
      * visible (they are hidden from the call to reAnalyseSelection
      * until they are requested through showPitchCandidates()). Note
-     * that this may return true even when no pitch candidate layers
-     * actually exist yet, because they are constructed
-     * asynchronously. If that is the case, then the layers will
-     * appear when they are created (otherwise they will remain hidden
-     * after creation).
+     * that this may return true even when no pitch candidates
+     * actually exist yet, because they are found asynchronously. If
+     * that is the case, then they will appear when they are found
+     * (otherwise they will remain hidden).
      */
     bool arePitchCandidatesShown() const;
 
     /**
-     * Show or hide the analysed pitch candidate layers. This is reset
-     * (to "hide") with each new call to reAnalyseSelection. Because
-     * the layers are created asynchronously, setting this to true
-     * does not guarantee that they appear immediately, only that they
-     * will appear once they have been created.
+     * Show or hide the analysed pitch candidates. This is reset (to
+     * "hide") with each new call to reAnalyseSelection. Because the
+     * candidates are found asynchronously, setting this to true does
+     * not guarantee that they appear immediately, only that they will
+     * appear once they have been found. Showing and hiding them is
+     * not recorded in the undo history.
      */
     void showPitchCandidates(bool shown);
 
     /**
      * If a re-analysis has been activated, switch the selected area
      * of the main pitch track to a different candidate from the
-     * analysis results.
+     * analysis results. This is an undoable edit of the pitch track.
      */
     void switchPitchCandidate(sv::Selection sel, bool up);
 
+    /**
+     * As switchPitchCandidate, but switching every one of the given
+     * selections to the same new candidate, as a single edit of the
+     * pitch track. Return the regions of the pitch track that were
+     * changed, with overlapping selections merged, so that the notes
+     * within them can be snapped to the new pitches.
+     */
+    std::vector<sv::Selection> switchPitchCandidates
+    (const sv::MultiSelection::SelectionList &selections, bool up);
+
     /**
      * Return true if it is possible to switch up to another pitch
      * candidate. This may mean that the currently selected pitch
@@ -198,10 +241,12 @@ public:
 
     /**
      * Remove any re-analysis layers and also reset the pitch track in
-     * the given selection to its state prior to the last re-analysis,
-     * abandoning any changes made since then. No re-analysis layers
-     * will be available until after the next call to
-     * reAnalyseSelection.
+     * the given selection to its state prior to the last re-analysis
+     * of that selection that changed it, abandoning any changes made
+     * since then. Calling this again goes back to the state before
+     * the re-analysis prior to that, as far as the stored snapshots
+     * allow. No re-analysis layers will be available until after the
+     * next call to reAnalyseSelection.
      */
     void abandonReAnalysis(sv::Selection sel);
 
@@ -231,11 +276,28 @@ signals:
     void layersChanged();
     void initialAnalysisCompleted();
 
+public slots:
+    /**
+     * Note that the user has moved the playhead or scrolled to the
+     * given frame. Pitch candidates around it will be computed in the
+     * background, if nothing more urgent is running, so that a
+     * selection made there can be given them without waiting.
+     */
+    void navigatedTo(sv::sv_frame_t);
+
 protected slots:
     void layerAboutToBeDeleted(sv::Layer *);
     void layerCompletionChanged(sv::ModelId);
+    void previewCompletionChanged(sv::ModelId);
+    void harvestPreviewChunk();
+    void speculate();
+    void speculationCompletionChanged(sv::ModelId);
+    void harvestSpeculation();
+    void deltaCompletionChanged(sv::ModelId);
+    void harvestDelta();
     void reAnalyseRegion(sv::sv_frame_t, sv::sv_frame_t, float, float);
     void materialiseReAnalysis();
+    void contentHashed(int generation, QString key);
 
 protected:
     sv::Document *m_document;
@@ -245,21 +307,99 @@ protected:
 
     mutable std::map<Component, sv::Layer *> m_layers;
 
-    sv::Clipboard m_preAnalysis;
+    PitchSnapshotStore m_preAnalysis; // pitches before each re-analysis
+    std::unique_ptr<SpectrumCache> m_spectrumCache; // for constrained peaks
     sv::Selection m_reAnalysingSelection;
     FrequencyRange m_reAnalysingRange;
-    std::vector<sv::Layer *> m_reAnalysisCandidates;
+    CandidateOverlay m_candidateOverlay;
+    sv::Layer *m_candidateLayer; // displays m_candidateOverlay
     int m_currentCandidate;
     bool m_candidatesVisible;
     sv::Document::LayerCreationAsyncHandle m_currentAsyncHandle;
     QMutex m_asyncMutex;
 
+    // Key under which to cache the initial analysis once it
+    // completes; empty if it came from the cache or is not cacheable
+    // (or not known yet, see startContentHash)
+    QString m_pendingCacheKey;
+
+    // Threads hashing the audio file for the cache key, and a count
+    // of the analyses started, so that a hash that arrives after its
+    // analysis has been replaced can be ignored
+    std::set<QThread *> m_hashThreads;
+    int m_hashGeneration;
+
+    // Progressive preview of the initial analysis, built up a chunk
+    // at a time starting from the visible part of the pane (see
+    // startPreview)
+    sv::Transforms m_previewTransforms;
+    sv::Layer *m_previewPitchLayer;
+    sv::Layer *m_previewNoteLayer;
+    std::set<int> m_previewChunksDone;
+    int m_previewChunk;
+    sv::Document::LayerCreationAsyncHandle m_previewAsyncHandle;
+    std::vector<sv::Layer *> m_previewChunkLayers;
+    bool m_previewHarvestPending;
+
+    // Speculative candidate analysis of the windows around wherever
+    // the user last navigated to, run while nothing else is (see
+    // speculate)
+    CandidateCache m_candidateCache;
+    QTimer *m_speculationTimer;
+    sv::sv_frame_t m_speculationFrame;
+    sv::Document::LayerCreationAsyncHandle m_speculationAsyncHandle;
+    std::vector<sv::Layer *> m_speculationLayers;
+    sv::sv_frame_t m_speculationStart;
+    sv::sv_frame_t m_speculationEnd;
+    bool m_speculationWholeFile;
+    bool m_speculationHarvestPending;
+
+    // Analysis of whichever part of the selection being re-analysed
+    // is not yet in the candidate cache, done one uncovered range at
+    // a time so that a selection that moves on can take over the
+    // ranges already analysed for it (see startDelta)
+    sv::Document::LayerCreationAsyncHandle m_deltaAsyncHandle;
+    std::vector<sv::Layer *> m_deltaLayers;
+    sv::sv_frame_t m_deltaStart;
+    sv::sv_frame_t m_deltaEnd;
+    bool m_deltaHarvestPending;
+
     QString doAllAnalyses(bool withPitchTrack);
 
     QString addVisualisations();
     QString addWaveform();
     QString addAnalyses();
-
+    std::vector<sv::Layer *> addCachedAnalyses(QString cacheKey);
+    void addAnalysisLayers(const std::vector<sv::Layer *> &layers);
+    void startContentHash(QString path, sv::sv_samplerate_t rate,
+                          bool normalised, sv::Transforms transforms);
+    void storeAnalysesInCache();
+
+    void startPreview(const sv::Transforms &transforms);
+    void schedulePreviewChunk();
+    void stopPreview();
+    sv::sv_frame_t getPreviewChunkLength() const;
+
+    sv::sv_frame_t getSpeculationWindowLength() const;
+    bool getSpeculationWindow(int window,
+                              sv::sv_frame_t &start,
+                              sv::sv_frame_t &end) const;
+    void stopSpeculation();
+
+    bool findConstrainedPeaks(sv::Selection sel, FrequencyRange range,
+                              CandidateCache::Tracks &tracks);
+
+    QString startDelta();
+    void stopDelta();
+    void continueReAnalysis();
+
+    bool areCandidateLayersReady(const std::vector<sv::Layer *> &layers) const;
+    CandidateCache::Tracks takeCandidateTracks(std::vector<sv::Layer *> &layers);
+
+    static sv::sv_frame_t getCandidateOutputLatency(const sv::Transform &t);
+    QString makeCandidateTransform(sv::Selection sel, FrequencyRange range,
+                                   sv::Transform &transform) const;
+    void installPitchCandidates(const CandidateCache::Tracks &tracks);
     void discardPitchCandidates();
 
     void stackLayers();
@@ -0,0 +1,289 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "AnalysisCache.h"
+
+#include <QSettings>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDateTime>
+
+#include <iostream>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+
+using namespace sv;
+
+static const quint32 cacheMagic = 0x546f6e41; // "TonA"
+static const quint32 cacheVersion = 1;
+static const int maxEntries = 200;
+
+bool
+AnalysisCache::isEnabled()
+{
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    bool enabled = settings.value(getSettingKey(), true).toBool();
+    settings.endGroup();
+    return enabled;
+}
+
+QString
+AnalysisCache::getCacheDirectory()
+{
+    QString dir = QStandardPaths::writableLocation
+        (QStandardPaths::CacheLocation);
+    if (dir == "") return "";
+    dir = QDir(dir).filePath("analysis");
+    if (!QDir().mkpath(dir)) return "";
+    return dir;
+}
+
+QString
+AnalysisCache::getIndexPath(QString audioPath)
+{
+    QFileInfo fi(audioPath);
+    if (!fi.exists() || !fi.isFile()) return "";
+
+    QString dir = getCacheDirectory();
+    if (dir == "") return "";
+
+    QByteArray stamp = QString("%1|%2|%3")
+        .arg(fi.canonicalFilePath())
+        .arg(fi.size())
+        .arg(fi.lastModified().toMSecsSinceEpoch())
+        .toUtf8();
+    return QDir(dir).filePath
+        (QCryptographicHash::hash(stamp, QCryptographicHash::Sha1)
+         .toHex() + ".ref");
+}
+
+QString
+AnalysisCache::getKnownContentHash(QString audioPath)
+{
+    QString indexPath = getIndexPath(audioPath);
+    if (indexPath == "") return "";
+
+    QFile index(indexPath);
+    if (!index.open(QIODevice::ReadOnly)) return "";
+    QString hash = QString::fromLatin1(index.readAll()).trimmed();
+    index.close();
+
+    if (hash != "") touch(indexPath);
+    return hash;
+}
+
+QString
+AnalysisCache::getContentHash(QString audioPath)
+{
+    QString hash = getKnownContentHash(audioPath);
+    if (hash != "") return hash;
+
+    QFile file(audioPath);
+    if (!file.open(QIODevice::ReadOnly)) return "";
+    QCryptographicHash hasher(QCryptographicHash::Sha1);
+    if (!hasher.addData(&file)) return "";
+    hash = QString::fromLatin1(hasher.result().toHex());
+
+    QString indexPath = getIndexPath(audioPath);
+    if (indexPath != "") {
+        QSaveFile index(indexPath);
+        if (index.open(QIODevice::WriteOnly)) {
+            index.write(hash.toLatin1());
+            index.commit();
+        }
+    }
+
+    return hash;
+}
+
+QString
+AnalysisCache::makeKey(QString contentHash,
+                       sv_samplerate_t sampleRate,
+                       bool normalised,
+                       const Transforms &transforms)
+{
+    if (contentHash == "") return "";
+
+    QCryptographicHash hasher(QCryptographicHash::Sha1);
+
+    auto add = [&](QString s) {
+        hasher.addData(s.toUtf8());
+        hasher.addData("\n", 1);
+    };
+
+    add(QString("%1").arg(cacheVersion));
+    add(contentHash);
+    add(QString("%1").arg(sampleRate));
+    add(normalised ? "normalised" : "unnormalised");
+
+    for (const auto &t: transforms) {
+        add(t.getIdentifier());
+        add(t.getPluginVersion());
+        add(QString("%1:%2").arg(t.getStepSize()).arg(t.getBlockSize()));
+        for (const auto &p: t.getParameters()) {
+            add(QString("%1=%2").arg(p.first).arg(p.second));
+        }
+    }
+
+    return QString::fromLatin1(hasher.result().toHex());
+}
+
+bool
+AnalysisCache::load(QString key, Result &result)
+{
+    if (key == "") return false;
+
+    QString dir = getCacheDirectory();
+    if (dir == "") return false;
+
+    QString path = QDir(dir).filePath(key + ".tcache");
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&file);
+
+    quint32 magic = 0, version = 0;
+    in >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion) {
+        cerr << "AnalysisCache::load: ignoring entry with wrong format "
+             << "for key " << key << endl;
+        return false;
+    }
+
+    Result r;
+    double rate = 0;
+    qint32 pitchResolution = 1, noteResolution = 1;
+    qint64 endFrame = 0;
+    quint32 pitchCount = 0, noteCount = 0;
+
+    in >> rate >> pitchResolution >> noteResolution >> endFrame;
+    r.sampleRate = rate;
+    r.pitchResolution = pitchResolution;
+    r.noteResolution = noteResolution;
+    r.endFrame = endFrame;
+
+    in >> pitchCount;
+    if (in.status() != QDataStream::Ok) return false;
+    r.pitches.reserve(pitchCount);
+    for (quint32 i = 0; i < pitchCount && in.status() == QDataStream::Ok; ++i) {
+        qint64 frame = 0;
+        float value = 0.f;
+        in >> frame >> value;
+        r.pitches.push_back(Event(frame, value, ""));
+    }
+
+    in >> noteCount;
+    if (in.status() != QDataStream::Ok) return false;
+    r.notes.reserve(noteCount);
+    for (quint32 i = 0; i < noteCount && in.status() == QDataStream::Ok; ++i) {
+        qint64 frame = 0, duration = 0;
+        float value = 0.f, level = 0.f;
+        QString label;
+        in >> frame >> value >> duration >> level >> label;
+        r.notes.push_back(Event(frame, value, duration, level, label));
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        cerr << "AnalysisCache::load: entry for key " << key
+             << " is truncated or corrupt" << endl;
+        return false;
+    }
+
+    file.close();
+    touch(path);
+
+    result = r;
+    return true;
+}
+
+bool
+AnalysisCache::store(QString key, const Result &result)
+{
+    if (key == "") return false;
+
+    QString dir = getCacheDirectory();
+    if (dir == "") return false;
+
+    QSaveFile file(QDir(dir).filePath(key + ".tcache"));
+    if (!file.open(QIODevice::WriteOnly)) return false;
+
+    QDataStream out(&file);
+
+    out << cacheMagic << cacheVersion;
+    out << double(result.sampleRate)
+        << qint32(result.pitchResolution)
+        << qint32(result.noteResolution)
+        << qint64(result.endFrame);
+
+    out << quint32(result.pitches.size());
+    for (const auto &e: result.pitches) {
+        out << qint64(e.getFrame()) << e.getValue();
+    }
+
+    out << quint32(result.notes.size());
+    for (const auto &e: result.notes) {
+        out << qint64(e.getFrame()) << e.getValue()
+            << qint64(e.getDuration()) << e.getLevel() << e.getLabel();
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        cerr << "AnalysisCache::store: failed to write entry for key "
+             << key << endl;
+        return false;
+    }
+
+    prune();
+    return true;
+}
+
+void
+AnalysisCache::touch(QString path)
+{
+    // Entries are pruned by modification time, so bring it up to
+    // date whenever one is used
+    QFile file(path);
+    if (file.open(QIODevice::ReadWrite)) {
+        file.setFileTime(QDateTime::currentDateTime(),
+                         QFileDevice::FileModificationTime);
+    }
+}
+
+void
+AnalysisCache::prune()
+{
+    QString dir = getCacheDirectory();
+    if (dir == "") return;
+
+    // Sorted most recently used first, so anything past the limit has
+    // gone unused the longest. The
+    // content-hash references are tiny, but there may be several for
+    // each result, so they are allowed a more generous limit
+
+    for (auto p: std::vector<std::pair<QString, int>> {
+            { "*.tcache", maxEntries }, { "*.ref", maxEntries * 10 } }) {
+        QFileInfoList entries = QDir(dir).entryInfoList
+            ({ p.first }, QDir::Files, QDir::Time);
+        for (int i = p.second; i < entries.size(); ++i) {
+            QFile::remove(entries[i].absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,107 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef ANALYSIS_CACHE_H
+#define ANALYSIS_CACHE_H
+
+#include <QString>
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+#include "transform/Transform.h"
+
+/**
+ * An on-disk cache of initial pitch and note analysis results, so
+ * that reopening an unchanged audio file does not need to run pYIN
+ * again.
+ *
+ * An entry is keyed by the content of the audio file, together with
+ * everything that affects how it is decoded (the sample rate it is
+ * loaded at and whether it is normalised) and the identity, version,
+ * step and block size and parameters of each transform. The content
+ * is that of the file as stored rather than the decoded audio, which
+ * is not available until decoding has finished. Hashing a long file
+ * is itself not free, so the content hash is remembered against the
+ * file's path, size and modification time and only recalculated when
+ * one of those changes; the caller is expected to do that on a
+ * background thread.
+ */
+class AnalysisCache
+{
+public:
+    struct Result {
+        Result() : sampleRate(0), pitchResolution(1), noteResolution(1),
+                   endFrame(0) { }
+        sv::sv_samplerate_t sampleRate;
+        int pitchResolution;
+        int noteResolution;
+        sv::sv_frame_t endFrame;
+        sv::EventVector pitches;
+        sv::EventVector notes;
+    };
+
+    /**
+     * Return true if the cache is enabled in the Analyser settings
+     * group. It is enabled by default.
+     */
+    static bool isEnabled();
+
+    /**
+     * Return the content hash remembered for the given local audio
+     * file in its present state, or an empty string if it has not
+     * been hashed since it last changed. This is quick enough to call
+     * from the GUI thread.
+     */
+    static QString getKnownContentHash(QString audioPath);
+
+    /**
+     * Return the content hash of the given local audio file, reading
+     * and hashing the whole file if it is not already known, or an
+     * empty string if the file cannot be read. May be called from any
+     * thread.
+     */
+    static QString getContentHash(QString audioPath);
+
+    /**
+     * Return the cache key for audio with the given content hash
+     * analysed with the given transforms.
+     */
+    static QString makeKey(QString contentHash,
+                           sv::sv_samplerate_t sampleRate,
+                           bool normalised,
+                           const sv::Transforms &transforms);
+
+    /**
+     * Look up the given key. Return true and fill in the result if a
+     * valid entry was found, marking it as recently used.
+     */
+    static bool load(QString key, Result &result);
+
+    /**
+     * Store a result under the given key, discarding the least
+     * recently used entries if the cache has grown too large.
+     * Return true on success.
+     */
+    static bool store(QString key, const Result &result);
+
+    static QString getSettingKey() { return "analysis-cache"; }
+
+protected:
+    static QString getCacheDirectory();
+    static QString getIndexPath(QString audioPath);
+    static void touch(QString path);
+    static void prune();
+};
+
+#endif
@@ -0,0 +1,157 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "AnalysisParameters.h"
+
+#include "transform/TransformFactory.h"
+#include "base/Debug.h"
+
+#include <QSettings>
+#include <QCoreApplication>
+
+#include <stdexcept>
+
+using std::endl;
+
+using namespace sv;
+
+AnalysisParameters::AnalysisParameters() :
+    precise(false),
+    lowamp(true),
+    onset(true),
+    prune(true)
+{
+}
+
+std::map<QString, QVariant>
+AnalysisParameters::getSettingDefaults()
+{
+    return { { "precision-analysis", false },
+             { "lowamp-analysis", true },
+             { "onset-analysis", true },
+             { "prune-analysis", true }
+    };
+}
+
+AnalysisParameters
+AnalysisParameters::fromSettings()
+{
+    AnalysisParameters params;
+
+    QSettings settings;
+    settings.beginGroup("Analyser");
+
+    std::map<QString, bool &> flags {
+        { "precision-analysis", params.precise },
+        { "lowamp-analysis", params.lowamp },
+        { "onset-analysis", params.onset },
+        { "prune-analysis", params.prune }
+    };
+
+    auto keyMap = getSettingDefaults();
+
+    for (auto p: flags) {
+        auto ki = keyMap.find(p.first);
+        if (ki != keyMap.end()) {
+            p.second = settings.value(ki->first, ki->second).toBool();
+        } else {
+            throw std::logic_error("Internal error: One or more analysis settings keys not found in map: check fromSettings and getSettingDefaults");
+        }
+    }
+
+    settings.endGroup();
+
+    return params;
+}
+
+QString
+AnalysisParameters::getPitchTransformId()
+{
+    return "vamp:pyin:pyin:smoothedpitchtrack";
+}
+
+QString
+AnalysisParameters::getNoteTransformId()
+{
+    return "vamp:pyin:pyin:notes";
+}
+
+Transforms
+AnalysisParameters::getTransforms(sv_samplerate_t sampleRate,
+                                  QString &error) const
+{
+    TransformFactory *tf = TransformFactory::getInstance();
+
+    QString plugname = "pYIN";
+    QString f0out = getPitchTransformId();
+    QString noteout = getNoteTransformId();
+
+    QString notFound = QCoreApplication::translate
+        ("Analyser", "Transform \"%1\" not found. Unable to analyse audio file.<br><br>Is the %2 Vamp plugin correctly installed?");
+    if (!tf->haveTransform(f0out)) {
+        error = notFound.arg(f0out).arg(plugname);
+        return {};
+    }
+    if (!tf->haveTransform(noteout)) {
+        error = notFound.arg(noteout).arg(plugname);
+        return {};
+    }
+
+    Transforms transforms;
+
+    Transform t = tf->getDefaultTransformFor(f0out, sampleRate);
+    t.setStepSize(stepSize);
+    t.setBlockSize(blockSize);
+
+    if (precise) {
+        SVDEBUG << "setting parameters for precise mode" << endl;
+        t.setParameter("precisetime", 1);
+    } else {
+        SVDEBUG << "setting parameters for vague mode" << endl;
+        t.setParameter("precisetime", 0);
+    }
+
+    if (lowamp) {
+        SVDEBUG << "setting parameters for lowamp suppression" << endl;
+        t.setParameter("lowampsuppression", 0.2f);
+    } else {
+        SVDEBUG << "setting parameters for no lowamp suppression" << endl;
+        t.setParameter("lowampsuppression", 0.0f);
+    }
+
+    if (onset) {
+        SVDEBUG << "setting parameters for increased onset sensitivity" << endl;
+        t.setParameter("onsetsensitivity", 0.7f);
+    } else {
+        SVDEBUG << "setting parameters for non-increased onset sensitivity" << endl;
+        t.setParameter("onsetsensitivity", 0.0f);
+    }
+
+    if (prune) {
+        SVDEBUG << "setting parameters for duration pruning" << endl;
+        t.setParameter("prunethresh", 0.1f);
+    } else {
+        SVDEBUG << "setting parameters for no duration pruning" << endl;
+        t.setParameter("prunethresh", 0.0f);
+    }
+
+    transforms.push_back(t);
+
+    t.setOutput("notes");
+
+    transforms.push_back(t);
+
+    error = "";
+    return transforms;
+}
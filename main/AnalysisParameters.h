@@ -0,0 +1,74 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef ANALYSIS_PARAMETERS_H
+#define ANALYSIS_PARAMETERS_H
+
+#include <QString>
+#include <QVariant>
+
+#include <map>
+
+#include "transform/Transform.h"
+#include "base/BaseTypes.h"
+
+/**
+ * The user-selectable options for the initial pitch and note
+ * analysis, and the pYIN transforms they produce. This contains no
+ * GUI dependencies, so that the interactive Analyser and the headless
+ * batch tool can share exactly the same analysis configuration.
+ */
+class AnalysisParameters
+{
+public:
+    /**
+     * Construct with the default setting for each option.
+     */
+    AnalysisParameters();
+
+    /**
+     * Construct with the options currently stored in the Analyser
+     * group in QSettings.
+     */
+    static AnalysisParameters fromSettings();
+
+    /**
+     * Return the QSettings keys, and their default values, that
+     * affect analysis behaviour. These all live within the Analyser
+     * group in QSettings.
+     */
+    static std::map<QString, QVariant> getSettingDefaults();
+
+    /**
+     * Return the pitch-track and note transforms, in that order, for
+     * audio at the given sample rate. If the pYIN plugin is not
+     * available, return an empty list and set error to a
+     * user-readable message.
+     */
+    sv::Transforms getTransforms(sv::sv_samplerate_t sampleRate,
+                                 QString &error) const;
+
+    static QString getPitchTransformId();
+    static QString getNoteTransformId();
+
+    static const int stepSize = 256;
+    static const int blockSize = 2048;
+
+    bool precise;
+    bool lowamp;
+    bool onset;
+    bool prune;
+};
+
+#endif
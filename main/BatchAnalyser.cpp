@@ -0,0 +1,380 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BatchAnalyser.h"
+
+#include "base/Preferences.h"
+#include "data/fileio/FileSource.h"
+#include "data/fileio/CSVFileWriter.h"
+#include "data/fileio/MIDIFileWriter.h"
+#include "data/model/ReadOnlyWaveFileModel.h"
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/NoteModel.h"
+#include "transform/FeatureExtractionModelTransformer.h"
+
+#include "ChunkStitcher.h"
+
+#include <QFileInfo>
+#include <QDir>
+#include <QThread>
+
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+using namespace sv;
+
+// Pitches within this many cents are considered the same, both when
+// looking for somewhere to stitch chunks together and when comparing
+// chunked with whole-file results
+static const double stitchToleranceCents = 1.0;
+
+// The proportion of pitch frames, and of notes, that may differ
+// between chunked and whole-file analysis when comparing them
+static const double maxDifferingFrameProportion = 0.005;
+static const double maxDifferingNoteProportion = 0.02;
+
+BatchAnalyser::BatchAnalyser(AnalysisParameters params, Options options) :
+    m_params(params),
+    m_options(options)
+{
+}
+
+BatchAnalyser::~BatchAnalyser()
+{
+}
+
+QString
+BatchAnalyser::getOutputPath(QString audioPath, QString suffix) const
+{
+    QFileInfo fi(audioPath);
+    QString dir = m_options.outputDir;
+    if (dir == "") dir = fi.absolutePath();
+    return QDir(dir).filePath(fi.completeBaseName() + "." + suffix);
+}
+
+// Wait for a model to finish loading or generating. The wave file
+// model completes its cache fill via a queued signal, so we must
+// keep processing events for this thread while we wait.
+static bool
+waitUntilReady(std::shared_ptr<Model> model)
+{
+    int completion = 0;
+    while (model->isOK() && !model->isReady(&completion)) {
+        QCoreApplication::processEvents();
+        QThread::msleep(50);
+    }
+    return model->isOK();
+}
+
+QString
+BatchAnalyser::analyseFile(QString audioPath) const
+{
+    FileSource source(audioPath);
+    if (!source.isAvailable()) {
+        return tr("File \"%1\" could not be opened").arg(audioPath);
+    }
+    source.waitForData();
+
+    sv_samplerate_t targetRate = 0;
+    Preferences *prefs = Preferences::getInstance();
+    if (prefs->getResampleOnLoad()) {
+        targetRate = prefs->getFixedSampleRate();
+    }
+
+    auto waveModel = std::make_shared<ReadOnlyWaveFileModel>
+        (source, targetRate);
+    if (!waveModel->isOK()) {
+        return tr("Audio file \"%1\" could not be decoded").arg(audioPath);
+    }
+    ModelId waveId = ModelById::add(waveModel);
+
+    if (!waitUntilReady(waveModel)) {
+        ModelById::release(waveId);
+        return tr("Audio file \"%1\" could not be decoded").arg(audioPath);
+    }
+
+    QString error;
+    Transforms transforms = m_params.getTransforms
+        (waveModel->getSampleRate(), error);
+    if (transforms.empty()) {
+        ModelById::release(waveId);
+        return error;
+    }
+
+    if (m_options.compareChunked) {
+        error = compareChunked(audioPath, waveModel, waveId, transforms);
+        ModelById::release(waveId);
+        return error;
+    }
+
+    std::shared_ptr<SparseTimeValueModel> pitchModel;
+    std::shared_ptr<NoteModel> noteModel;
+
+    if (m_options.chunkDuration > 0.0) {
+        error = analyseChunked
+            (waveModel, waveId, transforms, pitchModel, noteModel);
+    } else {
+        error = analyseWhole(waveId, transforms, pitchModel, noteModel);
+    }
+
+    if (error != "") {
+        ModelById::release(waveId);
+        return tr("Failed to analyse \"%1\": %2").arg(audioPath).arg(error);
+    }
+
+    if (m_options.writePitchCsv) {
+
+        // As in the interactive application, the pitch track nominally
+        // ends with the audio, so that the gap-filled export covers
+        // the whole file
+        pitchModel->extendEndFrame(waveModel->getEndFrame());
+
+        CSVFileWriter writer(getOutputPath(audioPath, "pitch.csv"),
+                             pitchModel.get(), ",", DataExportFillGaps);
+        writer.write();
+        if (!writer.isOK()) error = writer.getError();
+    }
+
+    if (error == "" && m_options.writeNoteCsv) {
+        CSVFileWriter writer(getOutputPath(audioPath, "notes.csv"),
+                             noteModel.get(), ",", DataExportOmitLevel);
+        writer.write();
+        if (!writer.isOK()) error = writer.getError();
+    }
+
+    if (error == "" && m_options.writeNoteMidi) {
+        MIDIFileWriter writer(getOutputPath(audioPath, "notes.mid"),
+                              noteModel.get(), noteModel->getSampleRate());
+        writer.write();
+        if (!writer.isOK()) error = writer.getError();
+    }
+
+    ModelById::release(waveId);
+
+    return error;
+}
+
+QString
+BatchAnalyser::analyseWhole(ModelId waveId,
+                            const Transforms &transforms,
+                            std::shared_ptr<SparseTimeValueModel> &pitch,
+                            std::shared_ptr<NoteModel> &notes) const
+{
+    ModelTransformer::Models outputs;
+    QString error;
+    {
+        FeatureExtractionModelTransformer transformer
+            (ModelTransformer::Input(waveId), transforms);
+        transformer.start();
+        while (!transformer.wait(100)) {
+            QCoreApplication::processEvents();
+        }
+        outputs = transformer.getOutputModels();
+        error = transformer.getMessage();
+    }
+
+    if (outputs.size() == transforms.size()) {
+        pitch = ModelById::getAs<SparseTimeValueModel>(outputs[0]);
+        notes = ModelById::getAs<NoteModel>(outputs[1]);
+    }
+
+    // We hold the models through our own pointers from here on
+    for (auto id: outputs) ModelById::release(id);
+
+    if (outputs.size() != transforms.size()) {
+        return (error != "" ? error : tr("Analysis produced no output"));
+    }
+    if (!pitch || !notes) {
+        return tr("Analysis returned unexpected model types");
+    }
+    return "";
+}
+
+QString
+BatchAnalyser::analyseChunked(std::shared_ptr<WaveFileModel> waveModel,
+                              ModelId waveId,
+                              const Transforms &transforms,
+                              std::shared_ptr<SparseTimeValueModel> &pitch,
+                              std::shared_ptr<NoteModel> &notes) const
+{
+    sv_samplerate_t rate = waveModel->getSampleRate();
+    sv_frame_t end = waveModel->getEndFrame();
+
+    // Chunk boundaries fall on the analysis grid, so that every chunk
+    // produces its pitch track on the same frames as the others and
+    // as a whole-file analysis would
+
+    const sv_frame_t grid = AnalysisParameters::stepSize;
+    sv_frame_t chunkLength =
+        std::max(sv_frame_t(m_options.chunkDuration * rate) / grid,
+                 sv_frame_t(1)) * grid;
+    sv_frame_t overlap =
+        (sv_frame_t(m_options.chunkOverlap * rate) / grid) * grid;
+
+    std::vector<ChunkStitcher::Chunk> chunks;
+    for (sv_frame_t f = 0; f < end; f += chunkLength) {
+        ChunkStitcher::Chunk chunk;
+        chunk.coreStart = f;
+        chunk.coreEnd = std::min(f + chunkLength, end);
+        chunks.push_back(chunk);
+    }
+
+    // Each transformer runs in its own thread; we keep at most
+    // chunkThreads of them going at once
+
+    struct Running {
+        std::unique_ptr<FeatureExtractionModelTransformer> transformer;
+        int index;
+    };
+    std::vector<Running> running;
+    int next = 0;
+    QString error;
+
+    auto collect = [&](Running &r) {
+        ModelTransformer::Models outputs = r.transformer->getOutputModels();
+        QString message = r.transformer->getMessage();
+        if (outputs.size() == transforms.size()) {
+            auto p = ModelById::getAs<SparseTimeValueModel>(outputs[0]);
+            auto n = ModelById::getAs<NoteModel>(outputs[1]);
+            if (p && n) {
+                chunks[r.index].pitches = p->getAllEvents();
+                chunks[r.index].notes = n->getAllEvents();
+            } else if (error == "") {
+                error = tr("Analysis returned unexpected model types");
+            }
+        } else if (error == "") {
+            error = (message != "" ? message : tr("Analysis produced no output"));
+        }
+        for (auto id: outputs) ModelById::release(id);
+    };
+
+    while (next < int(chunks.size()) || !running.empty()) {
+
+        while (next < int(chunks.size()) &&
+               int(running.size()) < std::max(m_options.chunkThreads, 1)) {
+
+            sv_frame_t start = std::max(sv_frame_t(0),
+                                        chunks[next].coreStart - overlap);
+            sv_frame_t stop = std::min(end, chunks[next].coreEnd + overlap);
+            RealTime startTime = RealTime::frame2RealTime(start, rate);
+
+            Transforms chunkTransforms = transforms;
+            for (auto &t: chunkTransforms) {
+                t.setStartTime(startTime);
+                t.setDuration(RealTime::frame2RealTime(stop, rate) - startTime);
+            }
+
+            Running r;
+            r.transformer.reset(new FeatureExtractionModelTransformer
+                                (ModelTransformer::Input(waveId),
+                                 chunkTransforms));
+            r.index = next++;
+            r.transformer->start();
+            running.push_back(std::move(r));
+        }
+
+        // Collect every chunk that has finished, not just the oldest,
+        // so that a slot freed by a short chunk is refilled at once
+
+        bool collected = false;
+        for (auto i = running.begin(); i != running.end(); ) {
+            if (i->transformer->isFinished()) {
+                i->transformer->wait();
+                collect(*i);
+                i = running.erase(i);
+                collected = true;
+            } else {
+                ++i;
+            }
+        }
+
+        if (!collected) {
+            QCoreApplication::processEvents();
+            QThread::msleep(20);
+        }
+    }
+
+    if (error != "") {
+        return error;
+    }
+
+    ChunkStitcher stitcher(int(grid), stitchToleranceCents, overlap / 2);
+    EventVector stitchedPitches, stitchedNotes;
+    int unmatched = stitcher.stitch(chunks, stitchedPitches, stitchedNotes);
+    if (unmatched > 0) {
+        cerr << "WARNING: BatchAnalyser::analyseChunked: " << unmatched
+             << " of " << chunks.size() - 1 << " chunk boundaries had no "
+             << "point of agreement, results may differ near them" << endl;
+    }
+
+    pitch = std::make_shared<SparseTimeValueModel>(rate, int(grid), false);
+    pitch->setScaleUnits("Hz");
+    for (const auto &e: stitchedPitches) pitch->add(e);
+
+    notes = std::make_shared<NoteModel>
+        (rate, int(grid), false, NoteModel::FLEXI_NOTE);
+    notes->setScaleUnits("Hz");
+    for (const auto &e: stitchedNotes) notes->add(e);
+
+    return "";
+}
+
+QString
+BatchAnalyser::compareChunked(QString audioPath,
+                              std::shared_ptr<WaveFileModel> waveModel,
+                              ModelId waveId,
+                              const Transforms &transforms) const
+{
+    std::shared_ptr<SparseTimeValueModel> wholePitch, chunkedPitch;
+    std::shared_ptr<NoteModel> wholeNotes, chunkedNotes;
+
+    QString error = analyseWhole(waveId, transforms, wholePitch, wholeNotes);
+    if (error == "") {
+        error = analyseChunked(waveModel, waveId, transforms,
+                               chunkedPitch, chunkedNotes);
+    }
+    if (error != "") {
+        return tr("Failed to analyse \"%1\": %2").arg(audioPath).arg(error);
+    }
+
+    ChunkStitcher stitcher(AnalysisParameters::stepSize,
+                           stitchToleranceCents, 0);
+    auto a = stitcher.compare(wholePitch->getAllEvents(),
+                              wholeNotes->getAllEvents(),
+                              chunkedPitch->getAllEvents(),
+                              chunkedNotes->getAllEvents(),
+                              waveModel->getEndFrame());
+
+    int differing = a.voicingDiffers + a.pitchDiffers;
+    int unmatchedNotes = std::max(a.notesA, a.notesB) - a.notesMatched;
+
+    cerr << audioPath << ": " << a.frames << " frames, "
+         << a.voicingDiffers << " differ in voicing, "
+         << a.pitchDiffers << " differ in pitch by more than "
+         << stitchToleranceCents << " cents (max " << a.maxCents
+         << " cents); " << a.notesA << " notes whole, " << a.notesB
+         << " chunked, " << a.notesMatched << " matching" << endl;
+
+    if (differing > a.frames * maxDifferingFrameProportion ||
+        unmatchedNotes > std::max(a.notesA, a.notesB) *
+        maxDifferingNoteProportion) {
+        return tr("Chunked analysis of \"%1\" differs from whole-file analysis by more than the tolerance (%2 of %3 frames, %4 of %5 notes)")
+            .arg(audioPath).arg(differing).arg(a.frames)
+            .arg(unmatchedNotes).arg(std::max(a.notesA, a.notesB));
+    }
+
+    return "";
+}
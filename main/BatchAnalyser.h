@@ -0,0 +1,108 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef BATCH_ANALYSER_H
+#define BATCH_ANALYSER_H
+
+#include <QString>
+#include <QCoreApplication>
+
+#include "AnalysisParameters.h"
+
+#include "data/model/WaveFileModel.h"
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/NoteModel.h"
+
+#include <memory>
+
+/**
+ * Run the initial pitch and note analysis on an audio file without
+ * any document, pane or layer, and write the results alongside (or
+ * into a given output directory). The audio is loaded with the same
+ * resampling and normalisation preferences as the interactive
+ * application, and analysed with the same transforms, so the results
+ * match those of opening the file in Tony and exporting.
+ */
+class BatchAnalyser
+{
+    Q_DECLARE_TR_FUNCTIONS(BatchAnalyser)
+
+public:
+    struct Options {
+        Options() :
+            writePitchCsv(true), writeNoteCsv(true), writeNoteMidi(true),
+            chunkDuration(0.0), chunkOverlap(4.0), chunkThreads(1),
+            compareChunked(false) { }
+
+        /// Directory to write into; if empty, use the audio file's own
+        QString outputDir;
+
+        bool writePitchCsv;
+        bool writeNoteCsv;
+        bool writeNoteMidi;
+
+        /// If non-zero, analyse in chunks of this many seconds, up to
+        /// chunkThreads at once, and stitch the results together
+        double chunkDuration;
+
+        /// Seconds of audio either side of each chunk that are
+        /// analysed with it so that the chunks can be stitched
+        double chunkOverlap;
+
+        int chunkThreads;
+
+        /// Analyse each file both whole and in chunks, and fail if
+        /// the results differ by more than the stated tolerance
+        bool compareChunked;
+    };
+
+    BatchAnalyser(AnalysisParameters params, Options options);
+    virtual ~BatchAnalyser();
+
+    /**
+     * Load and analyse the given audio file and write the requested
+     * outputs. Return "" on success or a user-readable error string
+     * on failure. This may be called from more than one thread at
+     * once, provided each calling thread is a QThread.
+     */
+    virtual QString analyseFile(QString audioPath) const;
+
+    /**
+     * Return the path to which the given output for the given audio
+     * file would be written. The suffix is e.g. "pitch.csv".
+     */
+    QString getOutputPath(QString audioPath, QString suffix) const;
+
+protected:
+    AnalysisParameters m_params;
+    Options m_options;
+
+    QString analyseWhole(sv::ModelId waveId,
+                         const sv::Transforms &transforms,
+                         std::shared_ptr<sv::SparseTimeValueModel> &pitch,
+                         std::shared_ptr<sv::NoteModel> &notes) const;
+
+    QString analyseChunked(std::shared_ptr<sv::WaveFileModel> waveModel,
+                           sv::ModelId waveId,
+                           const sv::Transforms &transforms,
+                           std::shared_ptr<sv::SparseTimeValueModel> &pitch,
+                           std::shared_ptr<sv::NoteModel> &notes) const;
+
+    QString compareChunked(QString audioPath,
+                           std::shared_ptr<sv::WaveFileModel> waveModel,
+                           sv::ModelId waveId,
+                           const sv::Transforms &transforms) const;
+};
+
+#endif
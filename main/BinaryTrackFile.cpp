@@ -0,0 +1,358 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BinaryTrackFile.h"
+
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/NoteModel.h"
+
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <cstring>
+
+using namespace sv;
+
+namespace {
+
+const char magic[4] = { 'T', 'o', 'n', 'B' };
+const uint32_t version = 1;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t options;
+    double sampleRate;
+    int32_t hopSize;
+    int32_t blockSize;
+    uint64_t count;
+    uint64_t framesOffset;
+    uint64_t valuesOffset;
+    uint64_t durationsOffset;
+    uint64_t levelsOffset;
+    uint64_t voicingOffset;
+    int64_t endFrame;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(Header) == 96, "Header must match the documented layout");
+
+struct Columns {
+    Columns() : haveDurations(false), haveLevels(false), haveVoicing(false) { }
+    std::vector<int64_t> frames;
+    std::vector<float> values;
+    bool haveDurations;
+    std::vector<int64_t> durations;
+    bool haveLevels;
+    std::vector<float> levels;
+    bool haveVoicing;
+    std::vector<float> voicing;
+};
+
+enum Option {
+    Precise = 1,
+    Lowamp = 2,
+    Onset = 4,
+    Prune = 8
+};
+
+uint32_t
+toOptions(const AnalysisParameters &params)
+{
+    return ((params.precise ? Precise : 0) |
+            (params.lowamp ? Lowamp : 0) |
+            (params.onset ? Onset : 0) |
+            (params.prune ? Prune : 0));
+}
+
+AnalysisParameters
+fromOptions(uint32_t options)
+{
+    AnalysisParameters params;
+    params.precise = (options & Precise);
+    params.lowamp = (options & Lowamp);
+    params.onset = (options & Onset);
+    params.prune = (options & Prune);
+    return params;
+}
+
+uint64_t
+align(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t(7);
+}
+
+template <typename T>
+bool
+writeColumn(QSaveFile &file, const std::vector<T> &column)
+{
+    qint64 bytes = qint64(column.size() * sizeof(T));
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if (file.write(reinterpret_cast<const char *>(column.data()), bytes)
+        != bytes) {
+        return false;
+    }
+#else
+    std::vector<T> swapped(column.size());
+    qToLittleEndian<T>(column.data(), column.size(), swapped.data());
+    if (file.write(reinterpret_cast<const char *>(swapped.data()), bytes)
+        != bytes) {
+        return false;
+    }
+#endif
+
+    static const char zeros[8] = { 0 };
+    qint64 padding = qint64(align(bytes) - bytes);
+    return file.write(zeros, padding) == padding;
+}
+
+template <typename T>
+const T *
+readColumn(const uchar *data, uint64_t offset, std::vector<T> &swapped,
+           size_t count)
+{
+    const T *column = reinterpret_cast<const T *>(data + offset);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    (void)swapped;
+    (void)count;
+    return column;
+#else
+    swapped.resize(count);
+    qFromLittleEndian<T>(column, count, swapped.data());
+    return swapped.data();
+#endif
+}
+
+QString
+writeFile(QString path, BinaryTrackFile::Kind kind,
+          sv_samplerate_t sampleRate, int hopSize, sv_frame_t endFrame,
+          const AnalysisParameters &params, const Columns &columns)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return BinaryTrackFile::tr("Failed to open file \"%1\" for writing: %2")
+            .arg(path).arg(file.errorString());
+    }
+
+    uint64_t count = columns.frames.size();
+    
+    Header h;
+    memcpy(h.magic, magic, 4);
+    h.version = qToLittleEndian(version);
+    h.kind = qToLittleEndian(uint32_t(kind));
+    h.options = qToLittleEndian(toOptions(params));
+    h.sampleRate = qToLittleEndian(double(sampleRate));
+    h.hopSize = qToLittleEndian(int32_t(hopSize));
+    h.blockSize = qToLittleEndian(int32_t(AnalysisParameters::blockSize));
+    h.count = qToLittleEndian(count);
+    h.endFrame = qToLittleEndian(int64_t(endFrame));
+    h.reserved = 0;
+
+    uint64_t offset = sizeof(Header);
+    auto place = [&](size_t size, bool present) -> uint64_t {
+        if (!present) return 0;
+        uint64_t here = offset;
+        offset = align(offset + count * size);
+        return qToLittleEndian(here);
+    };
+    
+    h.framesOffset = place(sizeof(int64_t), true);
+    h.valuesOffset = place(sizeof(float), true);
+    h.durationsOffset = place(sizeof(int64_t), columns.haveDurations);
+    h.levelsOffset = place(sizeof(float), columns.haveLevels);
+    h.voicingOffset = place(sizeof(float), columns.haveVoicing);
+
+    bool ok = (file.write(reinterpret_cast<const char *>(&h), sizeof(h))
+               == qint64(sizeof(h)));
+    
+    ok = ok && writeColumn(file, columns.frames);
+    ok = ok && writeColumn(file, columns.values);
+    ok = ok && writeColumn(file, columns.durations);
+    ok = ok && writeColumn(file, columns.levels);
+    ok = ok && writeColumn(file, columns.voicing);
+
+    if (!ok || !file.commit()) {
+        return BinaryTrackFile::tr("Failed to write file \"%1\": %2")
+            .arg(path).arg(file.errorString());
+    }
+
+    return "";
+}
+
+}
+
+QString
+BinaryTrackFile::writePitchTrack(QString path,
+                                 const SparseTimeValueModel &model,
+                                 const AnalysisParameters &params,
+                                 const std::vector<float> *voicing)
+{
+    EventVector events = model.getAllEvents();
+
+    Columns columns;
+    columns.frames.reserve(events.size());
+    columns.values.reserve(events.size());
+    for (const auto &e: events) {
+        columns.frames.push_back(e.getFrame());
+        columns.values.push_back(e.getValue());
+    }
+    if (voicing && voicing->size() == events.size()) {
+        columns.haveVoicing = true;
+        columns.voicing = *voicing;
+    }
+
+    return writeFile(path, PitchTrack, model.getSampleRate(),
+                     model.getResolution(), model.getEndFrame(),
+                     params, columns);
+}
+
+QString
+BinaryTrackFile::writeNotes(QString path,
+                            const NoteModel &model,
+                            const AnalysisParameters &params)
+{
+    EventVector events = model.getAllEvents();
+
+    Columns columns;
+    columns.haveDurations = true;
+    columns.haveLevels = true;
+    columns.frames.reserve(events.size());
+    columns.values.reserve(events.size());
+    columns.durations.reserve(events.size());
+    columns.levels.reserve(events.size());
+    for (const auto &e: events) {
+        columns.frames.push_back(e.getFrame());
+        columns.values.push_back(e.getValue());
+        columns.durations.push_back(e.getDuration());
+        columns.levels.push_back(e.getLevel());
+    }
+
+    return writeFile(path, Notes, model.getSampleRate(),
+                     model.getResolution(), model.getEndFrame(),
+                     params, columns);
+}
+
+BinaryTrackFile::BinaryTrackFile(QString path) :
+    m_kind(PitchTrack),
+    m_sampleRate(0),
+    m_hopSize(0),
+    m_blockSize(0),
+    m_endFrame(0),
+    m_count(0),
+    m_frames(0),
+    m_values(0),
+    m_durations(0),
+    m_levels(0),
+    m_voicing(0)
+{
+    open(path);
+}
+
+BinaryTrackFile::~BinaryTrackFile()
+{
+}
+
+void
+BinaryTrackFile::open(QString path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = tr("Failed to open file \"%1\": %2")
+            .arg(path).arg(m_file.errorString());
+        return;
+    }
+
+    QString invalid = tr("File \"%1\" is not a Tony binary track file, "
+                         "or is damaged").arg(path);
+    
+    uint64_t size = uint64_t(m_file.size());
+    if (size < sizeof(Header)) {
+        m_error = invalid;
+        return;
+    }
+
+    const uchar *data = m_file.map(0, qint64(size));
+    if (!data) {
+        m_error = tr("Failed to map file \"%1\": %2")
+            .arg(path).arg(m_file.errorString());
+        return;
+    }
+
+    Header h;
+    memcpy(&h, data, sizeof(h));
+
+    if (memcmp(h.magic, magic, 4) ||
+        qFromLittleEndian(h.version) != version) {
+        m_error = invalid;
+        return;
+    }
+
+    uint32_t kind = qFromLittleEndian(h.kind);
+    if (kind != PitchTrack && kind != Notes) {
+        m_error = invalid;
+        return;
+    }
+
+    uint64_t count = qFromLittleEndian(h.count);
+    
+    // Each column that is present must lie within the file, on an
+    // 8-byte boundary. Notes always have durations and levels
+    
+    auto valid = [&](uint64_t offset, size_t entrySize, bool required) {
+        offset = qFromLittleEndian(offset);
+        if (offset == 0) return !required;
+        return (offset >= sizeof(Header) && offset % 8 == 0 &&
+                offset <= size &&
+                count <= (size - offset) / entrySize);
+    };
+
+    if (!valid(h.framesOffset, sizeof(int64_t), true) ||
+        !valid(h.valuesOffset, sizeof(float), true) ||
+        !valid(h.durationsOffset, sizeof(int64_t), kind == Notes) ||
+        !valid(h.levelsOffset, sizeof(float), kind == Notes) ||
+        !valid(h.voicingOffset, sizeof(float), false)) {
+        m_error = invalid;
+        return;
+    }
+    
+    m_kind = Kind(kind);
+    m_sampleRate = qFromLittleEndian(h.sampleRate);
+    m_hopSize = qFromLittleEndian(h.hopSize);
+    m_blockSize = qFromLittleEndian(h.blockSize);
+    m_params = fromOptions(qFromLittleEndian(h.options));
+    m_endFrame = qFromLittleEndian(h.endFrame);
+    m_count = size_t(count);
+
+    if (m_sampleRate <= 0 || m_hopSize <= 0) {
+        m_error = invalid;
+        return;
+    }
+    
+    m_frames = readColumn(data, qFromLittleEndian(h.framesOffset),
+                          m_swappedFrames, m_count);
+    m_values = readColumn(data, qFromLittleEndian(h.valuesOffset),
+                          m_swappedValues, m_count);
+
+    if (uint64_t offset = qFromLittleEndian(h.durationsOffset)) {
+        m_durations = readColumn(data, offset, m_swappedDurations, m_count);
+    }
+    if (uint64_t offset = qFromLittleEndian(h.levelsOffset)) {
+        m_levels = readColumn(data, offset, m_swappedLevels, m_count);
+    }
+    if (uint64_t offset = qFromLittleEndian(h.voicingOffset)) {
+        m_voicing = readColumn(data, offset, m_swappedVoicing, m_count);
+    }
+}
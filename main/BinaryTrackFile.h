@@ -0,0 +1,150 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef BINARY_TRACK_FILE_H
+#define BINARY_TRACK_FILE_H
+
+#include "AnalysisParameters.h"
+
+#include "base/BaseTypes.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QString>
+
+#include <cstdint>
+#include <vector>
+
+namespace sv {
+class SparseTimeValueModel;
+class NoteModel;
+}
+
+/**
+ * A compact binary file holding a pitch track or a set of notes, for
+ * programs that want Tony's output without parsing text. It is
+ * written with the .tbin extension.
+ *
+ * The file is a 96-byte header followed by one array per column, all
+ * little-endian and each starting on an 8-byte boundary, so that a
+ * reader can map the file and use the arrays where they lie:
+ *
+ *   offset  type      field
+ *        0  char[4]   magic, "TonB"
+ *        4  uint32    version, currently 1
+ *        8  uint32    kind: 1 for a pitch track, 2 for notes
+ *       12  uint32    analysis options: bit 0 precise, 1 lowamp,
+ *                     2 onset, 3 prune
+ *       16  float64   sample rate
+ *       24  int32     hop size in frames
+ *       28  int32     block size in frames
+ *       32  uint64    row count
+ *       40  uint64    offset of frame column (int64)
+ *       48  uint64    offset of value column (float32, Hz)
+ *       56  uint64    offset of duration column (int64), or 0
+ *       64  uint64    offset of level column (float32), or 0
+ *       72  uint64    offset of voicing probability column
+ *                     (float32), or 0
+ *       80  int64     end frame of the track
+ *       88  uint64    reserved, 0
+ *
+ * Notes have duration and level columns. A pitch track may have a
+ * voicing probability column. Labels are not stored.
+ */
+class BinaryTrackFile
+{
+    Q_DECLARE_TR_FUNCTIONS(BinaryTrackFile)
+
+public:
+    enum Kind {
+        PitchTrack = 1,
+        Notes = 2
+    };
+
+    /**
+     * Write the given pitch track, with the voicing probability of
+     * each pitch if voicing is non-null and has one per pitch. Return
+     * an error message, or an empty string on success.
+     */
+    static QString writePitchTrack(QString path,
+                                   const sv::SparseTimeValueModel &model,
+                                   const AnalysisParameters &params,
+                                   const std::vector<float> *voicing = 0);
+
+    /**
+     * Write the given notes. Return an error message, or an empty
+     * string on success.
+     */
+    static QString writeNotes(QString path,
+                              const sv::NoteModel &model,
+                              const AnalysisParameters &params);
+
+    /**
+     * Open and map the given file for reading.
+     */
+    BinaryTrackFile(QString path);
+    ~BinaryTrackFile();
+
+    bool isOK() const { return m_error == ""; }
+    QString getError() const { return m_error; }
+    
+    Kind getKind() const { return m_kind; }
+    sv::sv_samplerate_t getSampleRate() const { return m_sampleRate; }
+    int getHopSize() const { return m_hopSize; }
+    int getBlockSize() const { return m_blockSize; }
+    AnalysisParameters getAnalysisParameters() const { return m_params; }
+    sv::sv_frame_t getEndFrame() const { return m_endFrame; }
+    
+    size_t getCount() const { return m_count; }
+
+    /**
+     * The columns, each with getCount() entries, or null if absent.
+     * They point into the mapped file, and are valid for as long as
+     * this object is.
+     */
+    const int64_t *getFrames() const { return m_frames; }
+    const float *getValues() const { return m_values; }
+    const int64_t *getDurations() const { return m_durations; }
+    const float *getLevels() const { return m_levels; }
+    const float *getVoicing() const { return m_voicing; }
+
+protected:
+    QFile m_file;
+    QString m_error;
+    
+    Kind m_kind;
+    sv::sv_samplerate_t m_sampleRate;
+    int m_hopSize;
+    int m_blockSize;
+    AnalysisParameters m_params;
+    sv::sv_frame_t m_endFrame;
+    size_t m_count;
+    
+    const int64_t *m_frames;
+    const float *m_values;
+    const int64_t *m_durations;
+    const float *m_levels;
+    const float *m_voicing;
+
+    // Columns converted from little-endian, on big-endian hosts only
+    std::vector<int64_t> m_swappedFrames;
+    std::vector<float> m_swappedValues;
+    std::vector<int64_t> m_swappedDurations;
+    std::vector<float> m_swappedLevels;
+    std::vector<float> m_swappedVoicing;
+
+    void open(QString path);
+};
+
+#endif
@@ -0,0 +1,368 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "CandidateCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace sv;
+
+// Enough for a minute or two of navigation either side of the
+// playhead with the window length the Analyser uses
+static const int maxWindows = 32;
+
+// Where windows are stitched together, a track from one continues a
+// track from the other if it starts within this many grid frames of
+// the cut and within this many cents of the other's last pitch
+static const int maxJoinGap = 2;
+static const double maxJoinCents = 100.0;
+
+CandidateCache::CandidateCache(int step) :
+    m_step(std::max(step, 1)),
+    m_haveWholeFile(false),
+    m_wholeOrigin(0),
+    m_wholeTrackCount(0)
+{
+}
+
+void
+CandidateCache::add(sv_frame_t start, sv_frame_t end, const Tracks &tracks)
+{
+    if (end <= start || m_haveWholeFile) return;
+
+    Window w;
+    w.start = start;
+    w.end = end;
+
+    // The plugin's timestamps need not fall within the selection
+    // itself, so the grid is anchored on the earliest of them
+
+    sv_frame_t first = std::numeric_limits<sv_frame_t>::max();
+    sv_frame_t last = std::numeric_limits<sv_frame_t>::min();
+    for (const auto &track: tracks) {
+        if (track.empty()) continue;
+        first = std::min(first, track.begin()->getFrame());
+        last = std::max(last, track.rbegin()->getFrame());
+    }
+
+    if (first > last) {
+        w.origin = start;
+    } else {
+        w.origin = first;
+        sv_frame_t count = (last - first) / m_step + 1;
+        for (const auto &track: tracks) {
+            if (track.empty()) continue;
+            std::vector<float> pitches(count, 0.f);
+            for (const auto &e: track) {
+                sv_frame_t i = (e.getFrame() - first + m_step / 2) / m_step;
+                if (i >= 0 && i < count) pitches[i] = e.getValue();
+            }
+            w.tracks.push_back(std::move(pitches));
+        }
+    }
+
+    // A window that this one covers is no longer of any use
+
+    m_windows.erase(std::remove_if(m_windows.begin(), m_windows.end(),
+                                   [&](const Window &other) {
+                                       return other.start >= start &&
+                                           other.end <= end;
+                                   }),
+                    m_windows.end());
+
+    m_windows.push_back(std::move(w));
+
+    if (int(m_windows.size()) > maxWindows) {
+        m_windows.erase(m_windows.begin(),
+                        m_windows.begin() + (m_windows.size() - maxWindows));
+    }
+}
+
+void
+CandidateCache::setWholeFile(const Tracks &tracks)
+{
+    clear();
+
+    sv_frame_t first = std::numeric_limits<sv_frame_t>::max();
+    sv_frame_t last = std::numeric_limits<sv_frame_t>::min();
+    for (const auto &track: tracks) {
+        if (track.empty()) continue;
+        first = std::min(first, track.begin()->getFrame());
+        last = std::max(last, track.rbegin()->getFrame());
+    }
+
+    m_haveWholeFile = true;
+    if (first > last) {
+        m_wholeOffsets.assign(1, 0);
+        return;
+    }
+
+    // Count the candidates at each frame, then fill them in. Empty
+    // tracks are dropped, so that track numbers are dense
+    
+    sv_frame_t count = (last - first) / m_step + 1;
+    m_wholeOrigin = first;
+    m_wholeOffsets.assign(count + 1, 0);
+
+    auto indexOf = [&](const Event &e) {
+        return (e.getFrame() - first + m_step / 2) / m_step;
+    };
+    
+    for (const auto &track: tracks) {
+        for (const auto &e: track) {
+            if (e.getValue() > 0.f) ++m_wholeOffsets[indexOf(e) + 1];
+        }
+    }
+    for (sv_frame_t i = 0; i < count; ++i) {
+        m_wholeOffsets[i + 1] += m_wholeOffsets[i];
+    }
+
+    m_wholePitches.resize(m_wholeOffsets[count]);
+    m_wholeTracks.resize(m_wholeOffsets[count]);
+    std::vector<uint32_t> fill(m_wholeOffsets.begin(), m_wholeOffsets.end() - 1);
+    
+    for (const auto &track: tracks) {
+        if (track.empty()) continue;
+        for (const auto &e: track) {
+            if (e.getValue() <= 0.f) continue;
+            uint32_t j = fill[indexOf(e)]++;
+            m_wholePitches[j] = e.getValue();
+            m_wholeTracks[j] = uint16_t(m_wholeTrackCount);
+        }
+        ++m_wholeTrackCount;
+    }
+}
+
+std::vector<const CandidateCache::Window *>
+CandidateCache::chain(sv_frame_t start, sv_frame_t end) const
+{
+    std::vector<const Window *> result;
+
+    // A single window is best if there is one, and then the one in
+    // which the range is most central, as the HMM decoding is least
+    // certain near the ends of the range it was run over
+
+    const Window *best = nullptr;
+    sv_frame_t bestMargin = -1;
+
+    for (const auto &w: m_windows) {
+        if (w.start > start || w.end < end) continue;
+        sv_frame_t margin = std::min(start - w.start, w.end - end);
+        if (margin > bestMargin) {
+            best = &w;
+            bestMargin = margin;
+        }
+    }
+
+    if (best) {
+        result.push_back(best);
+        return result;
+    }
+
+    // Otherwise a run of overlapping windows, each reaching as far
+    // past the end of the previous one as possible
+
+    sv_frame_t reached = start;
+    while (reached < end) {
+        const Window *next = nullptr;
+        for (const auto &w: m_windows) {
+            if (w.start <= reached && w.end > reached &&
+                (!next || w.end > next->end)) {
+                next = &w;
+            }
+        }
+        if (!next) return {};
+        result.push_back(next);
+        reached = next->end;
+    }
+
+    return result;
+}
+
+bool
+CandidateCache::covers(sv_frame_t start, sv_frame_t end) const
+{
+    if (m_haveWholeFile) return true;
+    return !chain(start, end).empty();
+}
+
+std::vector<std::pair<sv_frame_t, sv_frame_t>>
+CandidateCache::missing(sv_frame_t start, sv_frame_t end) const
+{
+    std::vector<std::pair<sv_frame_t, sv_frame_t>> gaps;
+    if (m_haveWholeFile || end <= start) return gaps;
+
+    std::vector<std::pair<sv_frame_t, sv_frame_t>> ranges;
+    for (const auto &w: m_windows) {
+        ranges.push_back({ w.start, w.end });
+    }
+    std::sort(ranges.begin(), ranges.end());
+
+    sv_frame_t reached = start;
+    for (const auto &r: ranges) {
+        if (r.second <= reached) continue;
+        if (r.first >= end) break;
+        if (r.first > reached) {
+            gaps.push_back({ reached, r.first });
+        }
+        reached = r.second;
+        if (reached >= end) break;
+    }
+    if (reached < end) {
+        gaps.push_back({ reached, end });
+    }
+    
+    return gaps;
+}
+
+CandidateCache::Tracks
+CandidateCache::sliceWindow(const Window &w,
+                            sv_frame_t start, sv_frame_t end) const
+{
+    Tracks result;
+
+    sv_frame_t i0 = std::max(sv_frame_t(0),
+                             (start - w.origin + m_step - 1) / m_step);
+
+    for (const auto &pitches: w.tracks) {
+        EventVector track;
+        sv_frame_t n = sv_frame_t(pitches.size());
+        for (sv_frame_t i = i0; i < n; ++i) {
+            sv_frame_t frame = w.origin + i * m_step;
+            if (frame >= end) break;
+            if (pitches[i] > 0.f) {
+                track.push_back(Event(frame, pitches[i], ""));
+            }
+        }
+        if (!track.empty()) {
+            result.push_back(std::move(track));
+        }
+    }
+
+    return result;
+}
+
+CandidateCache::Tracks
+CandidateCache::slice(sv_frame_t start, sv_frame_t end) const
+{
+    if (m_haveWholeFile) return sliceWholeFile(start, end);
+
+    auto windows = chain(start, end);
+    if (windows.empty()) return {};
+    
+    if (windows.size() == 1) {
+        return sliceWindow(*windows[0], start, end);
+    }
+
+    // Each window's tracks are its own, so where two windows meet we
+    // join each track from the later one onto whichever track from
+    // the earlier one it continues, if any. We cut in the middle of
+    // each overlap, where both decodings are furthest from their ends
+
+    Tracks result;
+    std::vector<bool> open; // per result track, whether it reached the cut
+    sv_frame_t from = start;
+
+    for (size_t k = 0; k < windows.size(); ++k) {
+
+        sv_frame_t to = end;
+        if (k + 1 < windows.size()) {
+            sv_frame_t overlapStart = std::max(windows[k+1]->start, from);
+            to = (overlapStart + windows[k]->end) / 2;
+            to = std::max(from, (to / m_step) * m_step);
+        }
+
+        Tracks pieces = sliceWindow(*windows[k], from, to);
+
+        std::vector<bool> joined(result.size(), false);
+        std::vector<bool> nowOpen(result.size(), false);
+
+        for (auto &piece: pieces) {
+
+            const Event &head = *piece.begin();
+            int target = -1;
+            double bestCents = maxJoinCents;
+
+            if (head.getFrame() < from + maxJoinGap * m_step) {
+                for (int i = 0; i < int(open.size()); ++i) {
+                    if (!open[i] || joined[i]) continue;
+                    const Event &tail = *result[i].rbegin();
+                    double cents = fabs(1200.0 * log2(double(head.getValue()) /
+                                                      double(tail.getValue())));
+                    if (cents <= bestCents) {
+                        target = i;
+                        bestCents = cents;
+                    }
+                }
+            }
+
+            bool reaches = (piece.rbegin()->getFrame() >=
+                            to - maxJoinGap * m_step);
+            
+            if (target >= 0) {
+                result[target].insert(result[target].end(),
+                                      piece.begin(), piece.end());
+                joined[target] = true;
+                nowOpen[target] = reaches;
+            } else {
+                result.push_back(std::move(piece));
+                joined.push_back(true);
+                nowOpen.push_back(reaches);
+            }
+        }
+
+        open = nowOpen;
+        from = to;
+    }
+
+    return result;
+}
+
+CandidateCache::Tracks
+CandidateCache::sliceWholeFile(sv_frame_t start, sv_frame_t end) const
+{
+    Tracks tracks(m_wholeTrackCount);
+    
+    sv_frame_t n = sv_frame_t(m_wholeOffsets.size()) - 1;
+    sv_frame_t i0 = std::max(sv_frame_t(0),
+                             (start - m_wholeOrigin + m_step - 1) / m_step);
+
+    for (sv_frame_t i = i0; i < n; ++i) {
+        sv_frame_t frame = m_wholeOrigin + i * m_step;
+        if (frame >= end) break;
+        for (uint32_t j = m_wholeOffsets[i]; j < m_wholeOffsets[i + 1]; ++j) {
+            tracks[m_wholeTracks[j]].push_back
+                (Event(frame, m_wholePitches[j], ""));
+        }
+    }
+
+    tracks.erase(std::remove_if(tracks.begin(), tracks.end(),
+                                [](const EventVector &t) { return t.empty(); }),
+                 tracks.end());
+    return tracks;
+}
+
+void
+CandidateCache::clear()
+{
+    m_windows.clear();
+    m_haveWholeFile = false;
+    m_wholeOrigin = 0;
+    m_wholeTrackCount = 0;
+    m_wholeOffsets.clear();
+    m_wholePitches.clear();
+    m_wholeTracks.clear();
+}
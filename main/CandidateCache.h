@@ -0,0 +1,121 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef CANDIDATE_CACHE_H
+#define CANDIDATE_CACHE_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Pitch candidate tracks from local re-analysis, kept so that a later
+ * selection lying within a range that has already been analysed can
+ * be given its candidates without running the plugin again.
+ *
+ * Each analysed range is stored as a window holding one array of
+ * pitches per candidate track, indexed by frame on the analysis grid,
+ * with zero where the track is unvoiced. The cache holds a limited
+ * number of windows and discards the least recently added. A range
+ * may be covered by several overlapping windows together, in which
+ * case their tracks are joined up where they meet.
+ *
+ * Alternatively the cache may hold an index of candidates for the
+ * whole file, which then covers any range. This is stored per frame
+ * rather than per track, with only the voiced candidates at each
+ * frame, since over a whole file most tracks are unvoiced most of
+ * the time.
+ */
+class CandidateCache
+{
+public:
+    typedef std::vector<sv::EventVector> Tracks;
+
+    CandidateCache(int step);
+
+    /**
+     * Record the candidate tracks found by analysing the selection
+     * from start to end. Events in each track must be in frame order.
+     */
+    void add(sv::sv_frame_t start, sv::sv_frame_t end, const Tracks &tracks);
+
+    /**
+     * Replace the contents of the cache with the candidate tracks
+     * found by analysing the whole file. Events in each track must be
+     * in frame order.
+     */
+    void setWholeFile(const Tracks &tracks);
+
+    bool hasWholeFile() const { return m_haveWholeFile; }
+
+    /**
+     * Return true if there is a whole-file index or the windows
+     * between them cover the whole of the range from start to end.
+     */
+    bool covers(sv::sv_frame_t start, sv::sv_frame_t end) const;
+
+    /**
+     * Return the parts of the range from start to end that no window
+     * covers, in order.
+     */
+    std::vector<std::pair<sv::sv_frame_t, sv::sv_frame_t>>
+    missing(sv::sv_frame_t start, sv::sv_frame_t end) const;
+
+    /**
+     * Return the parts of the candidate tracks lying between start
+     * and end, taken from the whole-file index if there is one, or
+     * else from the covering window in which that range is most
+     * central, or else from several windows joined together. Omit
+     * any track that has no pitches there, and return nothing if the
+     * range is not covered. Tracks from the whole-file index or a
+     * single window are returned in the same order for any range.
+     */
+    Tracks slice(sv::sv_frame_t start, sv::sv_frame_t end) const;
+
+    void clear();
+
+    int getWindowCount() const { return int(m_windows.size()); }
+
+protected:
+    struct Window {
+        sv::sv_frame_t start;
+        sv::sv_frame_t end;
+        sv::sv_frame_t origin; // frame of index 0 in each track
+        std::vector<std::vector<float>> tracks;
+    };
+
+    int m_step;
+    std::vector<Window> m_windows;
+
+    // Whole-file index: the candidates at grid frame i are entries
+    // m_wholeOffsets[i] to m_wholeOffsets[i+1] of the pitch and track
+    // arrays
+    bool m_haveWholeFile;
+    sv::sv_frame_t m_wholeOrigin;
+    int m_wholeTrackCount;
+    std::vector<uint32_t> m_wholeOffsets;
+    std::vector<float> m_wholePitches;
+    std::vector<uint16_t> m_wholeTracks;
+
+    std::vector<const Window *> chain(sv::sv_frame_t start,
+                                      sv::sv_frame_t end) const;
+    Tracks sliceWindow(const Window &w,
+                       sv::sv_frame_t start, sv::sv_frame_t end) const;
+    Tracks sliceWholeFile(sv::sv_frame_t start, sv::sv_frame_t end) const;
+};
+
+#endif
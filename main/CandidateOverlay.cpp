@@ -0,0 +1,73 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "CandidateOverlay.h"
+
+#include <algorithm>
+
+using namespace sv;
+
+CandidateOverlay::CandidateOverlay() :
+    m_trackOffsets(1, 0)
+{
+}
+
+void
+CandidateOverlay::set(const Tracks &tracks)
+{
+    clear();
+
+    size_t total = 0;
+    for (const auto &track: tracks) {
+        total += track.size();
+    }
+    m_frames.reserve(total);
+    m_pitches.reserve(total);
+
+    for (const auto &track: tracks) {
+        if (track.empty()) continue;
+        for (const auto &e: track) {
+            m_frames.push_back(e.getFrame());
+            m_pitches.push_back(e.getValue());
+        }
+        m_trackOffsets.push_back(int(m_frames.size()));
+    }
+}
+
+void
+CandidateOverlay::clear()
+{
+    m_frames.clear();
+    m_pitches.clear();
+    m_trackOffsets.assign(1, 0);
+}
+
+EventVector
+CandidateOverlay::getTrack(int track, sv_frame_t start, sv_frame_t end) const
+{
+    EventVector events;
+    if (track < 0 || track >= getTrackCount()) return events;
+
+    auto first = m_frames.begin() + m_trackOffsets[track];
+    auto last = m_frames.begin() + m_trackOffsets[track + 1];
+    auto i0 = std::lower_bound(first, last, start);
+    auto i1 = std::lower_bound(i0, last, end);
+
+    for (auto i = i0; i != i1; ++i) {
+        int ix = int(i - m_frames.begin());
+        events.push_back(Event(*i, m_pitches[ix], ""));
+    }
+    
+    return events;
+}
@@ -0,0 +1,69 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef CANDIDATE_OVERLAY_H
+#define CANDIDATE_OVERLAY_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+
+#include <vector>
+
+/**
+ * The pitch candidates for the selection currently being re-analysed,
+ * held as one flat array of points ordered by candidate track and
+ * then by frame, with the offset at which each track begins.
+ *
+ * This is what the user chooses between when switching candidates.
+ * It is not part of the document and has no undo history of its own:
+ * only the choice of candidate, once applied to the pitch track, is
+ * an edit.
+ */
+class CandidateOverlay
+{
+public:
+    typedef std::vector<sv::EventVector> Tracks;
+
+    CandidateOverlay();
+
+    /**
+     * Replace the contents with the given candidate tracks. Events in
+     * each track must be in frame order; empty tracks are dropped.
+     */
+    void set(const Tracks &tracks);
+
+    void clear();
+
+    bool isEmpty() const { return m_frames.empty(); }
+    
+    int getTrackCount() const { return int(m_trackOffsets.size()) - 1; }
+
+    int getPointCount() const { return int(m_frames.size()); }
+    sv::sv_frame_t getFrame(int i) const { return m_frames[i]; }
+    float getPitch(int i) const { return m_pitches[i]; }
+
+    /**
+     * Return the points of the given track whose frames lie between
+     * start and end.
+     */
+    sv::EventVector getTrack(int track,
+                             sv::sv_frame_t start, sv::sv_frame_t end) const;
+
+protected:
+    std::vector<sv::sv_frame_t> m_frames;
+    std::vector<float> m_pitches;
+    std::vector<int> m_trackOffsets; // track i is [offset[i], offset[i+1])
+};
+
+#endif
@@ -0,0 +1,193 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ChunkStitcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace sv;
+
+// Number of consecutive frames on which two chunks must agree for a
+// cut to be made there. Agreement on a single frame may be chance,
+// particularly where both are briefly unvoiced.
+static const int agreementRun = 4;
+
+ChunkStitcher::ChunkStitcher(int step, double toleranceCents,
+                             sv_frame_t searchRadius) :
+    m_step(std::max(step, 1)),
+    m_toleranceCents(toleranceCents),
+    m_searchRadius(searchRadius)
+{
+}
+
+// Return the pitch at the grid frame nearest the given one, or zero
+// if unvoiced there. The events must be sorted by frame.
+static float
+pitchAt(const EventVector &events, sv_frame_t frame, int step)
+{
+    auto i = std::lower_bound(events.begin(), events.end(),
+                              frame - step / 2,
+                              [](const Event &e, sv_frame_t f) {
+                                  return e.getFrame() < f;
+                              });
+    if (i != events.end() && i->getFrame() < frame + (step + 1) / 2) {
+        return i->getValue();
+    }
+    return 0.f;
+}
+
+static double
+centsBetween(float a, float b)
+{
+    return fabs(1200.0 * log2(double(a) / double(b)));
+}
+
+sv_frame_t
+ChunkStitcher::findCut(const Chunk &a, const Chunk &b, bool &agreed) const
+{
+    sv_frame_t boundary = a.coreEnd;
+    sv_frame_t radius = (m_searchRadius / m_step) * m_step;
+
+    auto agreeAt = [&](sv_frame_t f) {
+        float pa = pitchAt(a.pitches, f, m_step);
+        float pb = pitchAt(b.pitches, f, m_step);
+        if (pa <= 0.f || pb <= 0.f) {
+            return pa <= 0.f && pb <= 0.f;
+        }
+        return centsBetween(pa, pb) <= m_toleranceCents;
+    };
+
+    // Search outward from the boundary, alternately later and
+    // earlier, so as to cut as near to it as we can
+
+    for (sv_frame_t d = 0; d <= radius; d += m_step) {
+        std::vector<sv_frame_t> candidates { boundary + d };
+        if (d > 0) candidates.push_back(boundary - d);
+        for (sv_frame_t f: candidates) {
+            bool all = true;
+            for (int i = 0; i < agreementRun && all; ++i) {
+                all = agreeAt(f + i * m_step);
+            }
+            if (all) {
+                agreed = true;
+                return f;
+            }
+        }
+    }
+
+    agreed = false;
+    return boundary;
+}
+
+int
+ChunkStitcher::stitch(const std::vector<Chunk> &chunks,
+                      EventVector &pitches,
+                      EventVector &notes) const
+{
+    pitches.clear();
+    notes.clear();
+
+    int unmatched = 0;
+    sv_frame_t from = 0;
+    sv_frame_t noteFloor = 0;
+
+    for (int i = 0; i < int(chunks.size()); ++i) {
+
+        const Chunk &c = chunks[i];
+
+        // The last chunk runs to the end, whatever its core range
+        sv_frame_t to = std::numeric_limits<sv_frame_t>::max();
+
+        if (i + 1 < int(chunks.size())) {
+            bool agreed = false;
+            to = findCut(c, chunks[i + 1], agreed);
+            if (!agreed) ++unmatched;
+        }
+
+        for (const auto &e: c.pitches) {
+            if (e.getFrame() >= from && e.getFrame() < to) {
+                pitches.push_back(e);
+            }
+        }
+
+        // A note that spans the cut belongs to the chunk in which it
+        // starts; notes from the next chunk that start before it ends
+        // are the same note seen from the other side, so we skip them
+
+        for (const auto &e: c.notes) {
+            if (e.getFrame() >= std::max(from, noteFloor) && e.getFrame() < to) {
+                notes.push_back(e);
+                noteFloor = std::max(noteFloor,
+                                     e.getFrame() + e.getDuration());
+            }
+        }
+
+        from = to;
+    }
+
+    return unmatched;
+}
+
+ChunkStitcher::Agreement
+ChunkStitcher::compare(const EventVector &pitchesA,
+                       const EventVector &notesA,
+                       const EventVector &pitchesB,
+                       const EventVector &notesB,
+                       sv_frame_t endFrame) const
+{
+    Agreement result;
+
+    for (sv_frame_t f = 0; f < endFrame; f += m_step) {
+        float pa = pitchAt(pitchesA, f, m_step);
+        float pb = pitchAt(pitchesB, f, m_step);
+        ++result.frames;
+        if ((pa > 0.f) != (pb > 0.f)) {
+            ++result.voicingDiffers;
+        } else if (pa > 0.f) {
+            double cents = centsBetween(pa, pb);
+            result.maxCents = std::max(result.maxCents, cents);
+            if (cents > m_toleranceCents) {
+                ++result.pitchDiffers;
+            }
+        }
+    }
+
+    result.notesA = int(notesA.size());
+    result.notesB = int(notesB.size());
+
+    // Notes match if they start on the same grid frame and have the
+    // same duration and a pitch within tolerance
+
+    for (const auto &a: notesA) {
+        auto i = std::lower_bound(notesB.begin(), notesB.end(),
+                                  a.getFrame() - m_step / 2,
+                                  [](const Event &e, sv_frame_t f) {
+                                      return e.getFrame() < f;
+                                  });
+        for (; i != notesB.end() &&
+                 i->getFrame() < a.getFrame() + (m_step + 1) / 2; ++i) {
+            if (std::abs(i->getDuration() - a.getDuration()) <= m_step / 2 &&
+                a.getValue() > 0.f && i->getValue() > 0.f &&
+                centsBetween(a.getValue(), i->getValue()) <=
+                m_toleranceCents) {
+                ++result.notesMatched;
+                break;
+            }
+        }
+    }
+
+    return result;
+}
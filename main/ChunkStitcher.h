@@ -0,0 +1,98 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef CHUNK_STITCHER_H
+#define CHUNK_STITCHER_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+
+#include <vector>
+
+/**
+ * Join the pitch tracks and notes from analyses of overlapping chunks
+ * of one audio file into a single pitch track and note list.
+ *
+ * Each chunk has a core range, the chunks' core ranges abut, and each
+ * chunk was analysed over its core range plus an overlap either side.
+ * The pitch track is smoothed by a Viterbi decode over the whole of
+ * each chunk, so the two decodes either side of a core boundary may
+ * disagree near it. We cut instead at the frame nearest the boundary
+ * at which both chunks agree, for several frames running, on whether
+ * the frame is voiced and (if so) on its pitch: from there on the two
+ * decoded paths are in the same state and we can switch from one to
+ * the other without a discontinuity.
+ */
+class ChunkStitcher
+{
+public:
+    struct Chunk {
+        sv::sv_frame_t coreStart;
+        sv::sv_frame_t coreEnd;
+        sv::EventVector pitches;
+        sv::EventVector notes;
+    };
+
+    /**
+     * Construct a stitcher for pitch tracks on a grid of the given
+     * step size. Pitches within toleranceCents of one another are
+     * considered to agree, and the cut point is searched for up to
+     * searchRadius frames either side of each core boundary.
+     */
+    ChunkStitcher(int step, double toleranceCents,
+                  sv::sv_frame_t searchRadius);
+
+    /**
+     * Stitch the given chunks, which must be in order, into a single
+     * pitch track and note list. Return the number of boundaries at
+     * which no point of agreement was found, where the cut was made
+     * at the core boundary itself.
+     */
+    int stitch(const std::vector<Chunk> &chunks,
+               sv::EventVector &pitches,
+               sv::EventVector &notes) const;
+
+    struct Agreement {
+        Agreement() : frames(0), voicingDiffers(0), pitchDiffers(0),
+                      maxCents(0.0), notesA(0), notesB(0),
+                      notesMatched(0) { }
+        int frames;
+        int voicingDiffers;
+        int pitchDiffers;
+        double maxCents;
+        int notesA;
+        int notesB;
+        int notesMatched;
+    };
+
+    /**
+     * Compare two analyses of the same audio frame by frame over the
+     * grid up to endFrame, and note by note.
+     */
+    Agreement compare(const sv::EventVector &pitchesA,
+                      const sv::EventVector &notesA,
+                      const sv::EventVector &pitchesB,
+                      const sv::EventVector &notesB,
+                      sv::sv_frame_t endFrame) const;
+
+protected:
+    int m_step;
+    double m_toleranceCents;
+    sv::sv_frame_t m_searchRadius;
+
+    sv::sv_frame_t findCut(const Chunk &a, const Chunk &b,
+                           bool &agreed) const;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "CorpusScheduler.h"
+
+#include <QThread>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QCoreApplication>
+
+#include <algorithm>
+
+CorpusScheduler::CorpusScheduler(int threads, int maxInFlight) :
+    m_threads(std::max(threads, 1)),
+    m_inFlight(std::max(std::min(maxInFlight, m_threads), 1)),
+    m_failures(0)
+{
+    for (int i = 0; i < m_threads; ++i) {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+}
+
+CorpusScheduler::~CorpusScheduler()
+{
+}
+
+void
+CorpusScheduler::distribute(QStringList paths)
+{
+    std::vector<Item> items;
+    for (auto p: paths) {
+        items.push_back({ p, QFileInfo(p).size() });
+    }
+
+    // Largest first, and dealt to the least-loaded queue each time
+    // (greedy longest-processing-time assignment), so that stealing
+    // is only needed to correct for the file size being a poor
+    // estimate of analysis time
+    std::stable_sort(items.begin(), items.end(),
+                     [](const Item &a, const Item &b) {
+                         return a.cost > b.cost;
+                     });
+
+    for (const auto &item: items) {
+        WorkerQueue *target = m_queues[0].get();
+        for (const auto &q: m_queues) {
+            if (q->outstanding < target->outstanding) {
+                target = q.get();
+            }
+        }
+        target->items.push_back(item);
+        target->outstanding += item.cost;
+    }
+}
+
+bool
+CorpusScheduler::takeOwn(int worker, Item &item)
+{
+    WorkerQueue *q = m_queues[worker].get();
+    QMutexLocker locker(&q->mutex);
+    if (q->items.empty()) return false;
+    item = q->items.front();
+    q->items.pop_front();
+    q->outstanding -= item.cost;
+    return true;
+}
+
+bool
+CorpusScheduler::steal(int worker, Item &item)
+{
+    // Nothing is ever added to a queue once we have started, so a
+    // victim that looks empty stays empty and we can stop as soon as
+    // every queue is seen to be so
+
+    while (true) {
+
+        WorkerQueue *victim = nullptr;
+        qint64 most = -1;
+
+        for (int i = 1; i < m_threads; ++i) {
+            WorkerQueue *q = m_queues[(worker + i) % m_threads].get();
+            QMutexLocker locker(&q->mutex);
+            if (!q->items.empty() && q->outstanding > most) {
+                victim = q;
+                most = q->outstanding;
+            }
+        }
+
+        if (!victim) return false;
+
+        // Take from the opposite end to the owner, to avoid
+        // contending for the item it is about to start on
+
+        QMutexLocker locker(&victim->mutex);
+        if (victim->items.empty()) continue; // drained meanwhile
+        item = victim->items.back();
+        victim->items.pop_back();
+        victim->outstanding -= item.cost;
+        return true;
+    }
+}
+
+void
+CorpusScheduler::work(int worker, Task task, CompletionCallback callback)
+{
+    Item item;
+
+    while (true) {
+
+        // Wait for an in-flight slot before taking an item, so that a
+        // worker blocked here holds nothing that another worker with
+        // a slot could have stolen
+
+        m_inFlight.acquire();
+        if (!takeOwn(worker, item) && !steal(worker, item)) {
+            m_inFlight.release();
+            break;
+        }
+        QString error = task(item.path);
+        m_inFlight.release();
+
+        QMutexLocker locker(&m_callbackMutex);
+        if (error != "") ++m_failures;
+        if (callback) callback(item.path, error);
+    }
+}
+
+int
+CorpusScheduler::run(QStringList paths, Task task,
+                     CompletionCallback callback)
+{
+    m_failures = 0;
+
+    distribute(paths);
+
+    std::vector<QThread *> threads;
+    for (int i = 0; i < m_threads; ++i) {
+        threads.push_back(QThread::create([this, i, task, callback]() {
+                    work(i, task, callback);
+                }));
+        threads[i]->start();
+    }
+
+    for (auto t: threads) {
+        while (!t->wait(100)) {
+            QCoreApplication::processEvents();
+        }
+        delete t;
+    }
+
+    return m_failures;
+}
@@ -0,0 +1,91 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef CORPUS_SCHEDULER_H
+#define CORPUS_SCHEDULER_H
+
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QSemaphore>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Run a task over a list of files using a pool of worker threads
+ * with work stealing. Files are dealt out to per-worker queues,
+ * largest first, using the file size as an estimate of cost; a
+ * worker whose queue runs dry steals from the worker with the most
+ * outstanding work, so that long and short files balance across
+ * threads. The number of tasks running at once can be capped below
+ * the number of threads, to bound the number of decoded files held
+ * in memory at the same time.
+ *
+ * Workers are QThreads, so a task may create objects that rely on
+ * queued signals within its own thread (e.g. a WaveFileModel) as long
+ * as it processes events while waiting for them.
+ */
+class CorpusScheduler
+{
+public:
+    /**
+     * A task receives a file path and returns "" on success or an
+     * error message on failure.
+     */
+    typedef std::function<QString(QString)> Task;
+
+    /**
+     * Called from the worker thread as each file completes, with the
+     * file path and the task's return value. Calls are serialised.
+     */
+    typedef std::function<void(QString, QString)> CompletionCallback;
+
+    CorpusScheduler(int threads, int maxInFlight);
+    ~CorpusScheduler();
+
+    /**
+     * Run the task on every file and return when all have
+     * completed. Return the number of files whose task failed.
+     */
+    int run(QStringList paths, Task task, CompletionCallback callback);
+
+protected:
+    struct Item {
+        QString path;
+        qint64 cost;
+    };
+
+    struct WorkerQueue {
+        WorkerQueue() : outstanding(0) { }
+        QMutex mutex;
+        std::deque<Item> items;
+        qint64 outstanding;
+    };
+
+    int m_threads;
+    QSemaphore m_inFlight;
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    QMutex m_callbackMutex;
+    int m_failures;
+
+    void distribute(QStringList paths);
+    bool takeOwn(int worker, Item &item);
+    bool steal(int worker, Item &item);
+    void work(int worker, Task task, CompletionCallback callback);
+};
+
+#endif
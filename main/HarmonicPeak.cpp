@@ -0,0 +1,167 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "HarmonicPeak.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Function multiversioning needs the loader support that GCC has on
+// glibc-based systems; elsewhere the kernels are built once, for the
+// baseline instruction set
+#if defined(__GNUC__) && !defined(__clang__) && \
+    defined(__x86_64__) && defined(__linux__)
+#define TONY_TARGET_CLONES \
+    __attribute__((target_clones("avx2", "sse4.2", "default")))
+#else
+#define TONY_TARGET_CLONES
+#endif
+
+TONY_TARGET_CLONES
+static void
+harmonicProduct(const float *__restrict mags, int hs, int minbin, int n,
+                int harmonics, double *__restrict product)
+{
+    for (int i = 0; i < n; ++i) {
+        product[i] = mags[i + minbin];
+    }
+
+    // Bins whose jth harmonic is above the top of the spectrum are
+    // all at the end of the range, so each harmonic covers a prefix
+
+    for (int j = 2; j <= harmonics; ++j) {
+        int limit = std::min(n, hs / j - minbin + 1);
+        for (int i = 0; i < limit; ++i) {
+            product[i] *= mags[(i + minbin) * j];
+        }
+    }
+}
+
+TONY_TARGET_CLONES
+static void
+toDecibels(const double *__restrict product, const double *__restrict scale,
+           int n, double *__restrict hps)
+{
+    for (int i = 0; i < n; ++i) {
+        hps[i] = (product[i] > 0.0 ? scale[i] * log10(product[i]) : -120.0);
+    }
+}
+
+TONY_TARGET_CLONES
+static void
+interpolate(const int *__restrict index, const double *__restrict below,
+            const double *__restrict at, const double *__restrict above,
+            int count, int minbin, double binHz, double *__restrict peaks)
+{
+    for (int f = 0; f < count; ++f) {
+        double denom = below[f] - 2.0 * at[f] + above[f];
+        double offset = (denom != 0.0 ?
+                         0.5 * (below[f] - above[f]) / denom : 0.0);
+        peaks[f] = (index[f] < 0 ? 0.0 :
+                    (index[f] + offset + minbin) * binHz);
+    }
+}
+
+HarmonicPeak::HarmonicPeak(int fftSize, double sampleRate,
+                           double minFreq, double maxFreq, int harmonics) :
+    m_hs(fftSize / 2),
+    m_minbin(0),
+    m_n(0),
+    m_harmonics(std::max(harmonics, 1)),
+    m_binHz(sampleRate / fftSize)
+{
+    int minbin = int(floor(minFreq * fftSize / sampleRate));
+    int maxbin = int(ceil(maxFreq * fftSize / sampleRate));
+    if (minbin > m_hs) minbin = m_hs;
+    if (maxbin > m_hs) maxbin = m_hs;
+    if (minbin < 0 || maxbin <= minbin) return;
+
+    m_minbin = minbin;
+    m_n = maxbin - minbin + 1;
+
+    m_scale.resize(m_n);
+    for (int i = 0; i < m_n; ++i) {
+        int bin = i + minbin;
+        int contributing = (bin == 0 ? m_harmonics :
+                            std::min(m_harmonics, m_hs / bin));
+        m_scale[i] = 20.0 / contributing;
+    }
+
+    m_product.resize(m_n);
+    m_hps.resize(m_n);
+}
+
+int
+HarmonicPeak::findPeakBin(const float *mags,
+                          double &below, double &at, double &above)
+{
+    below = at = above = 0.0;
+    if (m_n == 0) return -1;
+
+    harmonicProduct(mags, m_hs, m_minbin, m_n, m_harmonics, m_product.data());
+    toDecibels(m_product.data(), m_scale.data(), m_n, m_hps.data());
+
+    double maxdb = -120.0;
+    int maxidx = 0;
+    for (int i = 0; i < m_n; ++i) {
+        if (m_hps[i] > maxdb) {
+            maxdb = m_hps[i];
+            maxidx = i;
+        }
+    }
+
+    // At either edge of the range the peak may lie outside it
+    if (maxidx == 0 || maxidx == m_n - 1) return -1;
+
+    below = m_hps[maxidx - 1];
+    at = m_hps[maxidx];
+    above = m_hps[maxidx + 1];
+    return maxidx;
+}
+
+double
+HarmonicPeak::find(const float *mags)
+{
+    double peak = 0.0;
+    findBatch(&mags, 1, &peak);
+    return peak;
+}
+
+void
+HarmonicPeak::findBatch(const float *const *mags, int count, double *peaks)
+{
+    if (count <= 0) return;
+
+    if (int(m_peakIndex.size()) < count) {
+        m_peakIndex.resize(count);
+        m_below.resize(count);
+        m_at.resize(count);
+        m_above.resize(count);
+    }
+
+    for (int f = 0; f < count; ++f) {
+        m_peakIndex[f] = findPeakBin(mags[f], m_below[f], m_at[f], m_above[f]);
+    }
+
+    interpolate(m_peakIndex.data(), m_below.data(), m_at.data(),
+                m_above.data(), count, m_minbin, m_binHz, peaks);
+}
+
+double
+HarmonicPeak::find(const float *mags, int fftSize, double sampleRate,
+                   double minFreq, double maxFreq, int harmonics)
+{
+    HarmonicPeak search(fftSize, sampleRate, minFreq, maxFreq, harmonics);
+    return search.find(mags);
+}
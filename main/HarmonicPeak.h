@@ -0,0 +1,77 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef HARMONIC_PEAK_H
+#define HARMONIC_PEAK_H
+
+#include <vector>
+
+/**
+ * The peak search of the Constrained Harmonic Peak plugin, for use on
+ * magnitude spectra the host already has, so that an outlined region
+ * can be re-analysed without running the plugin and its FFTs again.
+ *
+ * As in the plugin, a harmonic product spectrum is formed in dB over
+ * the bins between the minimum and maximum frequencies, from the
+ * magnitudes at each bin and its multiples up to the given number of
+ * harmonics; its peak bin is found, and the peak frequency is then
+ * interpolated quadratically from that bin and its neighbours.
+ *
+ * The inner loops are written to be vectorised, and on x86-64 Linux
+ * with GCC are compiled for several instruction sets with the best
+ * chosen at run time. Searching many frames at once with findBatch()
+ * also does the interpolation for all of them together.
+ */
+class HarmonicPeak
+{
+public:
+    HarmonicPeak(int fftSize, double sampleRate,
+                 double minFreq, double maxFreq, int harmonics);
+
+    /**
+     * Return the peak frequency in Hz, or 0 if there is no peak
+     * within the range. mags holds fftSize/2 + 1 magnitudes.
+     */
+    double find(const float *mags);
+
+    /**
+     * Find the peak frequency for each of count frames of
+     * magnitudes, writing it (or 0) to the corresponding element of
+     * peaks.
+     */
+    void findBatch(const float *const *mags, int count, double *peaks);
+
+    /**
+     * Return the peak frequency in a single frame, as find().
+     */
+    static double find(const float *mags, int fftSize, double sampleRate,
+                       double minFreq, double maxFreq, int harmonics);
+
+protected:
+    int m_hs;
+    int m_minbin;
+    int m_n; // bins in range, or 0 if the range is empty
+    int m_harmonics;
+    double m_binHz;
+    std::vector<double> m_scale; // 20 / number of harmonics, per bin
+    std::vector<double> m_product;
+    std::vector<double> m_hps;
+    std::vector<int> m_peakIndex;
+    std::vector<double> m_below, m_at, m_above;
+
+    int findPeakBin(const float *mags, double &below, double &at,
+                    double &above);
+};
+
+#endif
@@ -18,6 +18,11 @@
 #include "MainWindow.h"
 #include "NetworkPermissionTester.h"
 #include "Analyser.h"
+#include "AnalysisCache.h"
+#include "AnalysisParameters.h"
+#include "BinaryTrackFile.h"
+#include "NoteEdit.h"
+#include "PitchTrackWriter.h"
 
 #include "framework/Document.h"
 #include "framework/VersionTester.h"
@@ -26,6 +31,7 @@
 #include "view/PaneStack.h"
 #include "data/model/WaveFileModel.h"
 #include "data/model/NoteModel.h"
+#include "data/model/SparseTimeValueModel.h"
 #include "layer/FlexiNoteLayer.h"
 #include "view/ViewManager.h"
 #include "base/Preferences.h"
@@ -89,8 +95,10 @@
 #include <QDialogButtonBox>
 #include <QActionGroup>
 #include <QRegularExpression>
+#include <QFileDialog>
 
 #include <iostream>
+#include <cmath>
 #include <cstdio>
 #include <errno.h>
 
@@ -288,6 +296,10 @@ MainWindow::MainWindow(AudioMode audioMode,
             this, SLOT(updateLayerStatuses()));
     connect(m_analyser, SIGNAL(layersChanged()),
             this, SLOT(updateMenuStates()));
+    connect(m_viewManager, SIGNAL(playbackFrameChanged(sv_frame_t)),
+            m_analyser, SLOT(navigatedTo(sv_frame_t)));
+    connect(m_viewManager, SIGNAL(globalCentreFrameChanged(sv_frame_t)),
+            m_analyser, SLOT(navigatedTo(sv_frame_t)));
 
     setupMenus();
     setupToolbars();
@@ -774,6 +786,24 @@ MainWindow::setupAnalysisMenu()
     connect(m_autoAnalyse, SIGNAL(triggered()), this, SLOT(autoAnalysisToggled()));
     menu->addAction(m_autoAnalyse);
 
+    m_cacheAnalysis = new QAction(tr("&Reuse Previous Analysis Results"), this);
+    m_cacheAnalysis->setStatusTip(tr("When opening an audio file that has been analysed before with the same options, use the stored results instead of analysing it again."));
+    m_cacheAnalysis->setCheckable(true);
+    connect(m_cacheAnalysis, SIGNAL(triggered()), this, SLOT(cacheAnalysisToggled()));
+    menu->addAction(m_cacheAnalysis);
+
+    m_wholeFileCandidates = new QAction(tr("Find Pitch Candidates for &Whole File"), this);
+    m_wholeFileCandidates->setStatusTip(tr("After the initial analysis, find alternative pitch candidates for the whole file in the background, so that they are available at once for any selection."));
+    m_wholeFileCandidates->setCheckable(true);
+    connect(m_wholeFileCandidates, SIGNAL(triggered()), this, SLOT(wholeFileCandidatesToggled()));
+    menu->addAction(m_wholeFileCandidates);
+
+    m_progressiveAnalysis = new QAction(tr("Show &Preview During Analysis"), this);
+    m_progressiveAnalysis->setStatusTip(tr("While a new audio file is being analysed, analyse the part in view in short pieces as well, to show a preview of the results sooner. This uses more CPU while the analysis runs."));
+    m_progressiveAnalysis->setCheckable(true);
+    connect(m_progressiveAnalysis, SIGNAL(triggered()), this, SLOT(progressiveAnalysisToggled()));
+    menu->addAction(m_progressiveAnalysis);
+
     action = new QAction(tr("&Analyse Now!"), this);
     action->setStatusTip(tr("Trigger analysis of pitches and notes. (This will delete all existing pitches and notes.)"));
     connect(action, SIGNAL(triggered()), this, SLOT(analyseNow()));
@@ -823,6 +853,8 @@ MainWindow::resetAnalyseOptions()
     settings.beginGroup("Analyser");
 
     settings.setValue("auto-analysis", true);
+    settings.setValue(AnalysisCache::getSettingKey(), true);
+    settings.setValue(Analyser::getWholeFileCandidatesKey(), false);
     
     auto keyMap = Analyser::getAnalysisSettings();
     for (auto p: keyMap) {
@@ -842,6 +874,15 @@ MainWindow::updateAnalyseStates()
     bool autoAnalyse = settings.value("auto-analysis", true).toBool();
     m_autoAnalyse->setChecked(autoAnalyse);
 
+    m_cacheAnalysis->setChecked(settings.value
+                                (AnalysisCache::getSettingKey(), true).toBool());
+
+    m_wholeFileCandidates->setChecked
+        (settings.value(Analyser::getWholeFileCandidatesKey(), false).toBool());
+
+    m_progressiveAnalysis->setChecked
+        (settings.value(Analyser::getProgressiveAnalysisKey(), true).toBool());
+
     std::map<QString, QAction *> actions {
         { "precision-analysis", m_precise },
         { "lowamp-analysis", m_lowamp },
@@ -881,6 +922,62 @@ MainWindow::autoAnalysisToggled()
     updateAnalyseStates();
 }
 
+void
+MainWindow::cacheAnalysisToggled()
+{
+    QAction *a = qobject_cast<QAction *>(sender());
+    if (!a) return;
+
+    bool set = a->isChecked();
+
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    settings.setValue(AnalysisCache::getSettingKey(), set);
+    settings.endGroup();
+
+    // make result visible explicitly, in case e.g. we just set the wrong key
+    updateAnalyseStates();
+}
+
+void
+MainWindow::progressiveAnalysisToggled()
+{
+    QAction *a = qobject_cast<QAction *>(sender());
+    if (!a) return;
+
+    bool set = a->isChecked();
+
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    settings.setValue(Analyser::getProgressiveAnalysisKey(), set);
+    settings.endGroup();
+
+    // make result visible explicitly, in case e.g. we just set the wrong key
+    updateAnalyseStates();
+}
+
+void
+MainWindow::wholeFileCandidatesToggled()
+{
+    QAction *a = qobject_cast<QAction *>(sender());
+    if (!a) return;
+
+    bool set = a->isChecked();
+
+    QSettings settings;
+    settings.beginGroup("Analyser");
+    settings.setValue(Analyser::getWholeFileCandidatesKey(), set);
+    settings.endGroup();
+
+    // make result visible explicitly, in case e.g. we just set the wrong key
+    updateAnalyseStates();
+
+    // and start on it now, if the initial analysis is already done
+    if (set && m_analyser) {
+        m_analyser->navigatedTo(m_viewManager->getGlobalCentreFrame());
+    }
+}
+
 void
 MainWindow::precisionAnalysisToggled()
 {
@@ -1335,6 +1432,81 @@ MainWindow::selectOneNoteLeft()
 }
 
 
+void
+MainWindow::followNoteModel(ModelId modelId)
+{
+    auto previous = ModelById::get(m_noteBoundaryModel);
+    if (previous) {
+        disconnect(previous.get(), SIGNAL(modelChanged(ModelId)),
+                   this, SLOT(noteModelChanged(ModelId)));
+        disconnect(previous.get(), SIGNAL(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)),
+                   this, SLOT(noteModelChangedWithin(ModelId, sv_frame_t, sv_frame_t)));
+    }
+
+    m_noteBoundaryModel = modelId;
+
+    auto model = ModelById::get(modelId);
+    if (model) {
+        connect(model.get(), SIGNAL(modelChanged(ModelId)),
+                this, SLOT(noteModelChanged(ModelId)));
+        connect(model.get(), SIGNAL(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)),
+                this, SLOT(noteModelChangedWithin(ModelId, sv_frame_t, sv_frame_t)));
+    }
+
+    rebuildNoteBoundaries();
+}
+
+void
+MainWindow::rebuildNoteBoundaries()
+{
+    std::vector<sv_frame_t> boundaries;
+
+    auto model = ModelById::getAs<NoteModel>(m_noteBoundaryModel);
+    if (model) {
+        EventVector notes = model->getAllEvents();
+        boundaries.reserve(notes.size() * 2);
+        for (const auto &n: notes) {
+            NoteBoundaryIndex::addBoundaries(n.getFrame(), n.getDuration(),
+                                             boundaries);
+        }
+    }
+
+    m_noteBoundaries.reset(std::move(boundaries));
+}
+
+void
+MainWindow::noteModelChanged(ModelId modelId)
+{
+    if (modelId != m_noteBoundaryModel) return;
+    rebuildNoteBoundaries();
+}
+
+void
+MainWindow::noteModelChangedWithin(ModelId modelId,
+                                   sv_frame_t start, sv_frame_t end)
+{
+    if (modelId != m_noteBoundaryModel) return;
+
+    auto model = ModelById::getAs<NoteModel>(modelId);
+    if (!model) return;
+
+    // The change may have moved a boundary anywhere in the range, so
+    // recompute them all there from the notes that now touch it. A
+    // note's end boundary lies one frame past its end, hence the
+    // extra frames at the start of the query
+
+    EventVector notes = model->getEventsSpanning(start - 2, end - start + 3);
+
+    std::vector<sv_frame_t> boundaries;
+    boundaries.reserve(notes.size() * 2);
+    for (const auto &n: notes) {
+        NoteBoundaryIndex::addBoundaries(n.getFrame(), n.getDuration(),
+                                         boundaries);
+    }
+
+    m_noteBoundaries.replaceWithin(start, end, std::move(boundaries));
+}
+
 void
 MainWindow::moveByOneNote(bool right, bool doSelect)
 {
@@ -1357,34 +1529,17 @@ MainWindow::moveByOneNote(bool right, bool doSelect)
     auto model = ModelById::getAs<NoteModel>(layer->getModel());
     if (!model) return;
 
-    //!!! This seems like a strange and inefficient way to do this -
-    //!!! there is almost certainly a better way making use of
-    //!!! EventSeries api
-    
-    EventVector points = model->getAllEvents();
-    if (points.empty()) return;
-
-    EventVector::iterator i = points.begin();
-    std::set<sv_frame_t> snapFrames;
-    snapFrames.insert(0);
-    while (i != points.end()) {
-        snapFrames.insert(i->getFrame());
-        snapFrames.insert(i->getFrame() + i->getDuration() + 1);
-        ++i;
-    }
-    std::set<sv_frame_t>::iterator i2;
-    if (snapFrames.find(frame) == snapFrames.end()) {
-        // we're not on an existing snap point, so go to previous
-        snapFrames.insert(frame);
-    }
-    i2 = snapFrames.find(frame);
+    if (model->isEmpty()) return;
+
+    if (model->getId() != m_noteBoundaryModel) {
+        followNoteModel(model->getId());
+    }
+
     if (right) {
-        i2++;
-        if (i2 == snapFrames.end()) i2--;
+        frame = m_noteBoundaries.getNext(frame);
     } else {
-        if (i2 != snapFrames.begin()) i2--;
+        frame = m_noteBoundaries.getPrevious(frame);
     }
-    frame = *i2;
     m_viewManager->setPlaybackFrame(frame);
     if (doSelect) {
         Selection sel;
@@ -2179,10 +2334,72 @@ MainWindow::exportToSVL(QString path, Layer *layer)
     }
 }
 
+QString
+MainWindow::getTrackFileName(TrackFileDialog dialog)
+{
+    // The layer file filters of FileFinder come from svgui and know
+    // nothing of our binary track format, so the dialogs for pitch
+    // and note files list the formats themselves
+
+    QString binary = tr("Tony binary track files (*.tbin)");
+    QString csv = tr("Comma-separated data files (*.csv)");
+    QString tsv = tr("Tab-separated data files (*.tsv *.tab *.txt)");
+    QString svl = tr("Sonic Visualiser Layer XML files (*.svl)");
+    QString rdf = tr("RDF files (*.ttl *.n3)");
+    QString midi = tr("MIDI files (*.mid)");
+    QString all = tr("All files (*)");
+
+    QStringList filters;
+    switch (dialog) {
+    case ImportPitchTrack:
+        filters << tr("All supported files (*.tbin *.csv *.tsv *.tab *.txt)")
+                << binary << csv << tsv << all;
+        break;
+    case ExportPitchTrack:
+        filters << svl << csv << tsv << binary << rdf;
+        break;
+    case ExportNotes:
+        filters << svl << csv << tsv << midi << binary << rdf;
+        break;
+    }
+
+    QSettings settings;
+    settings.beginGroup("MainWindow");
+    QString dir = settings.value("track-file-directory", QDir::homePath())
+        .toString();
+
+    QString selected;
+    QString path;
+    if (dialog == ImportPitchTrack) {
+        path = QFileDialog::getOpenFileName
+            (this, tr("Select a file to import"), dir,
+             filters.join(";;"), &selected);
+    } else {
+        path = QFileDialog::getSaveFileName
+            (this, tr("Select a file to export to"), dir,
+             filters.join(";;"), &selected);
+
+        // Take the extension from the chosen type if none was typed
+        QRegularExpressionMatch match =
+            QRegularExpression("\\*\\.(\\w+)").match(selected);
+        if (path != "" && QFileInfo(path).suffix() == "" && match.hasMatch()) {
+            path += "." + match.captured(1);
+        }
+    }
+
+    if (path != "") {
+        settings.setValue("track-file-directory",
+                          QFileInfo(path).absolutePath());
+    }
+    settings.endGroup();
+
+    return path;
+}
+
 void
 MainWindow::importPitchLayer()
 {
-    QString path = getOpenFileName(FileFinder::LayerFileNoMidiNonSV);
+    QString path = getTrackFileName(ImportPitchTrack);
     if (path == "") return;
 
     FileOpenStatus status = importPitchLayer(path);
@@ -2209,6 +2426,46 @@ MainWindow::importPitchLayer(FileSource source)
     
     QString path = source.getLocalFilename();
 
+    if (source.getExtension().toLower() == "tbin") {
+
+        if (!getMainModel()) return FileOpenWrongMode;
+        
+        BinaryTrackFile file(path);
+        if (!file.isOK() || file.getKind() != BinaryTrackFile::PitchTrack) {
+            cerr << "MainWindow::importPitchLayer: " << file.getError() << endl;
+            return FileOpenFailed;
+        }
+
+        // The columns are read straight from the mapped file, with
+        // nothing to parse. Only the frames need converting, if the
+        // file was written at a different sample rate from the audio
+        // we have now. The model has no bulk insert, so the pitches
+        // still go into it one at a time, as they do from CSV
+        
+        sv_samplerate_t rate = getMainModel()->getSampleRate();
+        double ratio = rate / file.getSampleRate();
+        int resolution = std::max(1, int(lrint(file.getHopSize() * ratio)));
+        
+        auto model = std::make_shared<SparseTimeValueModel>
+            (rate, resolution, false);
+
+        const int64_t *frames = file.getFrames();
+        const float *values = file.getValues();
+        for (size_t i = 0; i < file.getCount(); ++i) {
+            sv_frame_t frame = (ratio == 1.0 ? frames[i] :
+                                sv_frame_t(llrint(double(frames[i]) * ratio)));
+            model->add(Event(frame, values[i], ""));
+        }
+
+        takeImportedPitchTrack(ModelById::add(model));
+
+        if (!source.isRemote()) {
+            registerLastOpenedFilePath(FileFinder::LayerFile, path);
+        }
+
+        return FileOpenSucceeded;
+    }
+
     RDFImporter::RDFDocumentType rdfType = 
         RDFImporter::identifyDocumentType(QUrl::fromLocalFile(path).toString());
 
@@ -2244,19 +2501,8 @@ MainWindow::importPitchLayer(FileSource source)
 
                 SVDEBUG << "MainWindow::importPitchLayer: Have model" << endl;
 
-                ModelId modelId = ModelById::add
-                    (std::shared_ptr<Model>(model));
-                
-                CommandHistory::getInstance()->startCompoundOperation
-                    (tr("Import Pitch Track"), true);
-
-                Layer *newLayer = m_document->createImportedLayer(modelId);
-
-                m_analyser->takePitchTrackFrom(newLayer);
-
-                m_document->deleteLayer(newLayer);
-
-                CommandHistory::getInstance()->endCompoundOperation();
+                takeImportedPitchTrack
+                    (ModelById::add(std::shared_ptr<Model>(model)));
 
                 if (!source.isRemote()) {
                     registerLastOpenedFilePath
@@ -2276,6 +2522,21 @@ MainWindow::importPitchLayer(FileSource source)
     return FileOpenFailed;
 }
 
+void
+MainWindow::takeImportedPitchTrack(ModelId modelId)
+{
+    CommandHistory::getInstance()->startCompoundOperation
+        (tr("Import Pitch Track"), true);
+
+    Layer *newLayer = m_document->createImportedLayer(modelId);
+
+    m_analyser->takePitchTrackFrom(newLayer);
+
+    m_document->deleteLayer(newLayer);
+
+    CommandHistory::getInstance()->endCompoundOperation();
+}
+
 void
 MainWindow::exportPitchLayer()
 {
@@ -2285,9 +2546,7 @@ MainWindow::exportPitchLayer()
     auto model = ModelById::getAs<SparseTimeValueModel>(layer->getModel());
     if (!model) return;
 
-    FileFinder::FileType type = FileFinder::LayerFileNoMidiNonSV;
-
-    QString path = getSaveFileName(type);
+    QString path = getTrackFileName(ExportPitchTrack);
 
     if (path == "") return;
 
@@ -2311,18 +2570,20 @@ MainWindow::exportPitchLayer()
             error = exporter.getError();
         }
 
+    } else if (suffix == "tbin") {
+
+        error = BinaryTrackFile::writePitchTrack
+            (path, *model, AnalysisParameters::fromSettings());
+
     } else {
 
-        DataExportOptions options = DataExportFillGaps;
+        // With a row for every hop, gaps included, this can run to
+        // millions of rows, which PitchTrackWriter writes out as it
+        // goes rather than building the text first as CSVFileWriter
+        // would
         
-        CSVFileWriter writer(path, model.get(),
-                             ((suffix == "csv") ? "," : "\t"),
-                             options);
-        writer.write();
-
-        if (!writer.isOK()) {
-            error = writer.getError();
-        }
+        PitchTrackWriter writer(path, (suffix == "csv") ? "," : "\t");
+        error = writer.write(*model);
     }
 
     if (error != "") {
@@ -2341,9 +2602,7 @@ MainWindow::exportNoteLayer()
     auto model = ModelById::getAs<NoteModel>(layer->getModel());
     if (!model) return;
 
-    FileFinder::FileType type = FileFinder::LayerFileNonSV;
-
-    QString path = getSaveFileName(type);
+    QString path = getTrackFileName(ExportNotes);
 
     if (path == "") return;
 
@@ -2373,6 +2632,11 @@ MainWindow::exportNoteLayer()
             error = exporter.getError();
         }
 
+    } else if (suffix == "tbin") {
+
+        error = BinaryTrackFile::writeNotes
+            (path, *model, AnalysisParameters::fromSettings());
+
     } else {
 
         DataExportOptions options = DataExportOmitLevel;
@@ -2564,12 +2828,12 @@ MainWindow::switchPitchUp()
             CommandHistory::getInstance()->startCompoundOperation
                 (tr("Choose Higher Pitch Candidate"), true);
 
-            MultiSelection::SelectionList selections = m_viewManager->getSelections();
-
-            for (MultiSelection::SelectionList::iterator k = selections.begin();
-                 k != selections.end(); ++k) {
-                m_analyser->switchPitchCandidate(*k, true);
-                auxSnapNotes(*k);
+            // One edit of the pitch track for all selections, then
+            // one snap for each region it changed
+            
+            for (const Selection &s: m_analyser->switchPitchCandidates
+                     (m_viewManager->getSelections(), true)) {
+                auxSnapNotes(s);
             }
 
             CommandHistory::getInstance()->endCompoundOperation();
@@ -2588,12 +2852,12 @@ MainWindow::switchPitchDown()
             CommandHistory::getInstance()->startCompoundOperation
                 (tr("Choose Lower Pitch Candidate"), true);
 
-            MultiSelection::SelectionList selections = m_viewManager->getSelections();
+            // One edit of the pitch track for all selections, then
+            // one snap for each region it changed
             
-            for (MultiSelection::SelectionList::iterator k = selections.begin();
-                 k != selections.end(); ++k) {
-                m_analyser->switchPitchCandidate(*k, false);
-                auxSnapNotes(*k);
+            for (const Selection &s: m_analyser->switchPitchCandidates
+                     (m_viewManager->getSelections(), false)) {
+                auxSnapNotes(s);
             }
 
             CommandHistory::getInstance()->endCompoundOperation();
@@ -2616,7 +2880,7 @@ MainWindow::snapNotesToPitches()
                 
         for (MultiSelection::SelectionList::iterator k = selections.begin();
              k != selections.end(); ++k) {
-            auxSnapNotes(*k);
+            auxSnapNotes(*k, true);
         }
         
         CommandHistory::getInstance()->endCompoundOperation();
@@ -2624,14 +2888,21 @@ MainWindow::snapNotesToPitches()
 }
 
 void
-MainWindow::auxSnapNotes(Selection s)
+MainWindow::auxSnapNotes(Selection s, bool all)
 {
     cerr << "in auxSnapNotes" << endl;
-    FlexiNoteLayer *layer =
-        qobject_cast<FlexiNoteLayer *>(m_analyser->getLayer(Analyser::Notes));
-    if (!layer) return;
+    Layer *notes = m_analyser->getLayer(Analyser::Notes);
+    Layer *pitches = m_analyser->getLayer(Analyser::PitchTrack);
+    if (!notes || !pitches) return;
 
-    layer->snapSelectedNotesToPitchTrack(m_analyser->getPane(), s);
+    if (notes->getModel() != m_noteSnapper.getNoteModel() ||
+        pitches->getModel() != m_noteSnapper.getPitchModel()) {
+        m_noteSnapper.setModels(pitches->getModel(), notes->getModel());
+    }
+
+    // Only the notes whose pitches have changed since they were last
+    // snapped, unless all were asked for
+    m_noteSnapper.snap(s, all);
 }    
 
 void
@@ -2647,46 +2918,46 @@ MainWindow::splitNote()
 void
 MainWindow::mergeNotes()
 {
-    FlexiNoteLayer *layer =
-        qobject_cast<FlexiNoteLayer *>(m_analyser->getLayer(Analyser::Notes));
+    Layer *layer = m_analyser->getLayer(Analyser::Notes);
+    Layer *pitches = m_analyser->getLayer(Analyser::PitchTrack);
     if (!layer) return;
 
     MultiSelection::SelectionList selections = m_viewManager->getSelections();
 
     if (!selections.empty()) {
 
-        CommandHistory::getInstance()->startCompoundOperation
-            (tr("Merge Notes"), true);
-                
+        NoteEdit edit(layer->getModel(),
+                      pitches ? pitches->getModel() : ModelId(),
+                      m_intelligentActionOn, tr("Merge Notes"));
+        
         for (MultiSelection::SelectionList::iterator k = selections.begin();
              k != selections.end(); ++k) {
-            layer->mergeNotes(m_analyser->getPane(), *k, true);
+            edit.mergeNotes(*k, true);
         }
         
-        CommandHistory::getInstance()->endCompoundOperation();
+        edit.commit();
     }
 }
 
 void
 MainWindow::deleteNotes()
 {
-    FlexiNoteLayer *layer =
-        qobject_cast<FlexiNoteLayer *>(m_analyser->getLayer(Analyser::Notes));
+    Layer *layer = m_analyser->getLayer(Analyser::Notes);
     if (!layer) return;
 
     MultiSelection::SelectionList selections = m_viewManager->getSelections();
 
     if (!selections.empty()) {
 
-        CommandHistory::getInstance()->startCompoundOperation
-            (tr("Delete Notes"), true);
+        NoteEdit edit(layer->getModel(), ModelId(),
+                      m_intelligentActionOn, tr("Delete Notes"));
                 
         for (MultiSelection::SelectionList::iterator k = selections.begin();
              k != selections.end(); ++k) {
-            layer->deleteSelectionInclusive(*k);
+            edit.deleteNotes(*k);
         }
         
-        CommandHistory::getInstance()->endCompoundOperation();
+        edit.commit();
     }
 }
 
@@ -2694,52 +2965,28 @@ MainWindow::deleteNotes()
 void
 MainWindow::formNoteFromSelection()
 {
-    Pane *pane = m_analyser->getPane();
-    Layer *layer0 = m_analyser->getLayer(Analyser::Notes);
-    auto model = ModelById::getAs<NoteModel>(layer0->getModel());
-    FlexiNoteLayer *layer = qobject_cast<FlexiNoteLayer *>(layer0);
-    if (!layer || !model) return;
+    Layer *layer = m_analyser->getLayer(Analyser::Notes);
+    Layer *pitches = m_analyser->getLayer(Analyser::PitchTrack);
+    if (!layer) return;
 
     MultiSelection::SelectionList selections = m_viewManager->getSelections();
 
     if (!selections.empty()) {
-    
-        CommandHistory::getInstance()->startCompoundOperation
-            (tr("Form Note from Selection"), true);
+
+        // The notes for all selections are worked out first, and the
+        // model changed once at the end, rather than splitting,
+        // deleting, adding and merging in the model for each
+        
+        NoteEdit edit(layer->getModel(),
+                      pitches ? pitches->getModel() : ModelId(),
+                      m_intelligentActionOn, tr("Form Note from Selection"));
 
         for (MultiSelection::SelectionList::iterator k = selections.begin();
              k != selections.end(); ++k) {
-
-            // Chop existing events at start and end frames; remember
-            // the first starting pitch, to use as default for new
-            // note; delete existing events; create new note; ask
-            // layer to merge, just in order to adapt the note to the
-            // existing pitch track if possible. This way we should
-            // handle all the possible cases of existing notes that
-            // may or may not overlap the start or end times
-            
-            sv_frame_t start = k->getStartFrame();
-            sv_frame_t end = k->getEndFrame();
-
-            EventVector existing =
-                model->getEventsStartingWithin(start, end - start);
-
-            int defaultPitch = 100;
-            if (!existing.empty()) {
-                defaultPitch = int(roundf(existing.begin()->getValue()));
-            }
-            
-            layer->splitNotesAt(pane, start);
-            layer->splitNotesAt(pane, end);
-            layer->deleteSelection(*k);
-            
-            layer->addNoteOn(start, defaultPitch, 100);
-            layer->addNoteOff(end, defaultPitch);
-            
-            layer->mergeNotes(pane, *k, false);
+            edit.formNote(*k);
         }
 
-        CommandHistory::getInstance()->endCompoundOperation();     
+        edit.commit();
     }
 }
 
@@ -18,6 +18,8 @@
 
 #include "framework/MainWindowBase.h"
 #include "Analyser.h"
+#include "NoteBoundaryIndex.h"
+#include "NoteSnapper.h"
 
 namespace sv {
 class VersionTester;
@@ -89,6 +91,9 @@ protected slots:
     virtual void analyseNow();
     virtual void resetAnalyseOptions();
     virtual void autoAnalysisToggled();
+    virtual void cacheAnalysisToggled();
+    virtual void wholeFileCandidatesToggled();
+    virtual void progressiveAnalysisToggled();
     virtual void precisionAnalysisToggled();
     virtual void lowampAnalysisToggled();
     virtual void onsetAnalysisToggled();
@@ -177,6 +182,9 @@ protected slots:
     void selectOneNoteRight();
     void selectOneNoteLeft();
 
+    void noteModelChanged(sv::ModelId);
+    void noteModelChangedWithin(sv::ModelId, sv::sv_frame_t, sv::sv_frame_t);
+
     void ffwd();
     void rewind();
 
@@ -205,6 +213,9 @@ protected:
     bool           m_intelligentActionOn; // GF: !!! temporary
 
     QAction       *m_autoAnalyse;
+    QAction       *m_cacheAnalysis;
+    QAction       *m_wholeFileCandidates;
+    QAction       *m_progressiveAnalysis;
     QAction       *m_precise;
     QAction       *m_lowamp;
     QAction       *m_onset;
@@ -228,13 +239,26 @@ protected:
 
     sv::sv_frame_t m_selectionAnchor;
 
+    NoteBoundaryIndex m_noteBoundaries;
+    sv::ModelId m_noteBoundaryModel; // the note model the index follows
+
+    NoteSnapper m_noteSnapper;
+
     bool m_withSonification;
     bool m_withSpectrogram;
 
     Analyser::FrequencyRange m_pendingConstraint;
 
     QString exportToSVL(QString path, sv::Layer *layer);
+    enum TrackFileDialog {
+        ImportPitchTrack,
+        ExportPitchTrack,
+        ExportNotes
+    };
+    QString getTrackFileName(TrackFileDialog dialog);
+
     FileOpenStatus importPitchLayer(sv::FileSource source);
+    void takeImportedPitchTrack(sv::ModelId);
 
     QString getReleaseText() const;
 
@@ -248,7 +272,7 @@ protected:
 
     virtual void octaveShift(bool up);
 
-    virtual void auxSnapNotes(sv::Selection s);
+    virtual void auxSnapNotes(sv::Selection s, bool all = false);
 
     virtual void closeEvent(QCloseEvent *e);
     bool checkSaveModified();
@@ -258,6 +282,8 @@ protected:
     virtual void updatePositionStatusDisplays() const;
 
     void moveByOneNote(bool right, bool doSelect);
+    void followNoteModel(sv::ModelId);
+    void rebuildNoteBoundaries();
 };
 
 
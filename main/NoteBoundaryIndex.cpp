@@ -0,0 +1,84 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "NoteBoundaryIndex.h"
+
+#include <algorithm>
+
+using namespace sv;
+
+NoteBoundaryIndex::NoteBoundaryIndex() :
+    m_boundaries(1, 0)
+{
+}
+
+void
+NoteBoundaryIndex::reset(std::vector<sv_frame_t> boundaries)
+{
+    boundaries.push_back(0);
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+    m_boundaries = std::move(boundaries);
+}
+
+void
+NoteBoundaryIndex::replaceWithin(sv_frame_t start, sv_frame_t end,
+                                 std::vector<sv_frame_t> boundaries)
+{
+    if (end < start) return;
+
+    boundaries.erase(std::remove_if(boundaries.begin(), boundaries.end(),
+                                    [&](sv_frame_t f) {
+                                        return f < start || f > end;
+                                    }),
+                     boundaries.end());
+    if (start <= 0) {
+        boundaries.push_back(0);
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+
+    // Overwrite the old boundaries in the range where we can, so that
+    // the usual small edit moves nothing else
+
+    auto i0 = std::lower_bound(m_boundaries.begin(), m_boundaries.end(), start);
+    auto i1 = std::upper_bound(i0, m_boundaries.end(), end);
+    size_t old = size_t(i1 - i0);
+    size_t common = std::min(old, boundaries.size());
+
+    std::copy(boundaries.begin(), boundaries.begin() + common, i0);
+    if (old > common) {
+        m_boundaries.erase(i0 + common, i1);
+    } else if (boundaries.size() > common) {
+        m_boundaries.insert(i1, boundaries.begin() + common, boundaries.end());
+    }
+}
+
+sv_frame_t
+NoteBoundaryIndex::getNext(sv_frame_t frame) const
+{
+    auto i = std::upper_bound(m_boundaries.begin(), m_boundaries.end(), frame);
+    if (i == m_boundaries.end()) return frame;
+    return *i;
+}
+
+sv_frame_t
+NoteBoundaryIndex::getPrevious(sv_frame_t frame) const
+{
+    auto i = std::lower_bound(m_boundaries.begin(), m_boundaries.end(), frame);
+    if (i == m_boundaries.begin()) return frame;
+    return *(i - 1);
+}
@@ -0,0 +1,77 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef NOTE_BOUNDARY_INDEX_H
+#define NOTE_BOUNDARY_INDEX_H
+
+#include "base/BaseTypes.h"
+
+#include <vector>
+
+/**
+ * The frames at which notes start and end, plus frame 0, in order,
+ * for moving the playhead from one note boundary to the next.
+ *
+ * The index is meant to be kept up to date with the note model as it
+ * changes: when a range of the model changes, the caller gathers the
+ * boundaries of the notes that now lie within that range and passes
+ * them to replaceWithin(). Looking up the next or previous boundary
+ * then takes a binary search and allocates nothing.
+ */
+class NoteBoundaryIndex
+{
+public:
+    NoteBoundaryIndex();
+
+    /**
+     * Append the boundaries of a note to the given vector: its start
+     * frame, and the frame following its end.
+     */
+    static void addBoundaries(sv::sv_frame_t frame, sv::sv_frame_t duration,
+                              std::vector<sv::sv_frame_t> &boundaries) {
+        boundaries.push_back(frame);
+        boundaries.push_back(frame + duration + 1);
+    }
+
+    /**
+     * Replace the contents with the given boundaries, in any order.
+     */
+    void reset(std::vector<sv::sv_frame_t> boundaries);
+
+    /**
+     * Replace the boundaries from start to end inclusive with those
+     * of the given ones that lie within that range, in any order.
+     */
+    void replaceWithin(sv::sv_frame_t start, sv::sv_frame_t end,
+                       std::vector<sv::sv_frame_t> boundaries);
+
+    /**
+     * Return the first boundary after the given frame, or the frame
+     * itself if there is none.
+     */
+    sv::sv_frame_t getNext(sv::sv_frame_t frame) const;
+
+    /**
+     * Return the last boundary before the given frame, or the frame
+     * itself if there is none.
+     */
+    sv::sv_frame_t getPrevious(sv::sv_frame_t frame) const;
+
+    int getCount() const { return int(m_boundaries.size()); }
+
+protected:
+    std::vector<sv::sv_frame_t> m_boundaries; // sorted, unique
+};
+
+#endif
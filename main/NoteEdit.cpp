@@ -0,0 +1,279 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "NoteEdit.h"
+#include "NoteSnapper.h"
+
+#include "data/model/NoteModel.h"
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/EventCommands.h"
+#include "base/CommandHistory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace sv;
+
+NoteEdit::NoteEdit(ModelId noteModel, ModelId pitchModel,
+                   bool intelligent, QString name) :
+    m_noteModel(noteModel),
+    m_pitchModel(pitchModel),
+    m_intelligent(intelligent),
+    m_name(name),
+    m_loaded(false),
+    m_maxDuration(0)
+{
+}
+
+bool
+NoteEdit::load()
+{
+    if (m_loaded) return true;
+    
+    auto model = ModelById::getAs<NoteModel>(m_noteModel);
+    if (!model) return false;
+
+    m_original = model->getAllEvents();
+    std::sort(m_original.begin(), m_original.end());
+    for (const auto &e: m_original) {
+        add(e);
+    }
+
+    m_loaded = true;
+    return true;
+}
+
+void
+NoteEdit::add(const Event &e)
+{
+    m_notes.insert({ e.getFrame(), e });
+    m_maxDuration = std::max(m_maxDuration, e.getDuration());
+}
+
+void
+NoteEdit::remove(const Event &e)
+{
+    auto range = m_notes.equal_range(e.getFrame());
+    for (auto i = range.first; i != range.second; ++i) {
+        if (i->second == e) {
+            m_notes.erase(i);
+            return;
+        }
+    }
+}
+
+EventVector
+NoteEdit::getSpanning(sv_frame_t start, sv_frame_t end) const
+{
+    // No note starting earlier than the longest one could reach start
+    
+    EventVector result;
+    for (auto i = m_notes.lower_bound(start - m_maxDuration);
+         i != m_notes.end() && i->first < end; ++i) {
+        const Event &e = i->second;
+        if (e.getDuration() == 0 ?
+            e.getFrame() >= start :
+            e.getFrame() + e.getDuration() > start) {
+            result.push_back(e);
+        }
+    }
+    return result;
+}
+
+EventVector
+NoteEdit::getWithin(sv_frame_t start, sv_frame_t end) const
+{
+    EventVector result;
+    for (auto i = m_notes.lower_bound(start);
+         i != m_notes.end() && i->first < end; ++i) {
+        const Event &e = i->second;
+        if (e.getFrame() + e.getDuration() <= end) {
+            result.push_back(e);
+        }
+    }
+    return result;
+}
+
+EventVector
+NoteEdit::getStartingWithin(sv_frame_t start, sv_frame_t end) const
+{
+    EventVector result;
+    for (auto i = m_notes.lower_bound(start);
+         i != m_notes.end() && i->first < end; ++i) {
+        result.push_back(i->second);
+    }
+    return result;
+}
+
+bool
+NoteEdit::updateValueFromPitches(Event &note) const
+{
+    auto pitches = ModelById::getAs<SparseTimeValueModel>(m_pitchModel);
+    if (!pitches) return false;
+
+    std::vector<double> values;
+    for (const auto &p: pitches->getEventsSpanning(note.getFrame(),
+                                                   note.getDuration())) {
+        values.push_back(p.getValue());
+    }
+
+    double median = 0.0;
+    if (!NoteSnapper::getMedian(values, median)) return false;
+    
+    note = note.withValue(float(median));
+    return true;
+}
+
+void
+NoteEdit::splitAt(sv_frame_t frame)
+{
+    // The first note covering the frame, as FlexiNoteLayer::splitNotesAt
+
+    const Event *found = nullptr;
+    for (auto i = m_notes.lower_bound(frame - m_maxDuration);
+         i != m_notes.end() && i->first <= frame; ++i) {
+        const Event &e = i->second;
+        if (e.getDuration() == 0 ?
+            e.getFrame() == frame :
+            e.getFrame() + e.getDuration() > frame) {
+            found = &e;
+            break;
+        }
+    }
+    if (!found) return;
+
+    Event note(*found);
+    remove(note);
+
+    Event parts[] = {
+        note.withDuration(frame - note.getFrame()),
+        note.withFrame(frame).withDuration(note.getFrame() +
+                                           note.getDuration() - frame)
+    };
+
+    for (auto part: parts) {
+        if (part.getDuration() <= 0) continue;
+        if (m_intelligent && !updateValueFromPitches(part)) continue;
+        add(part);
+    }
+}
+
+void
+NoteEdit::deleteNotes(Selection s)
+{
+    if (!load()) return;
+
+    for (const auto &e: getSpanning(s.getStartFrame(), s.getEndFrame())) {
+        remove(e);
+    }
+}
+
+void
+NoteEdit::mergeNotes(Selection s, bool inclusive)
+{
+    if (!load()) return;
+
+    sv_frame_t start = s.getStartFrame();
+    sv_frame_t end = s.getEndFrame();
+    
+    EventVector notes = (inclusive ?
+                         getSpanning(start, end) :
+                         getWithin(start, end));
+    if (notes.empty()) return;
+
+    Event merged(notes[0]);
+    for (const auto &e: notes) {
+        merged = merged.withDuration(e.getFrame() + e.getDuration() -
+                                     merged.getFrame());
+        remove(e);
+    }
+
+    updateValueFromPitches(merged);
+    add(merged);
+}
+
+void
+NoteEdit::formNote(Selection s)
+{
+    if (!load()) return;
+
+    // Split any notes crossing the ends of the selection and replace
+    // everything between with a single note, then merge it as a note
+    // within the selection so as to take its pitch from the pitch
+    // track where there is one. Until then it has the pitch of the
+    // first note that was there, if any
+    
+    sv_frame_t start = s.getStartFrame();
+    sv_frame_t end = s.getEndFrame();
+
+    EventVector existing = getStartingWithin(start, end);
+    
+    int defaultPitch = 100;
+    if (!existing.empty()) {
+        defaultPitch = int(roundf(existing.begin()->getValue()));
+    }
+
+    splitAt(start);
+    splitAt(end);
+
+    for (const auto &e: getStartingWithin(start, end)) {
+        remove(e);
+    }
+
+    add(Event(start, float(defaultPitch), end - start, 100.f / 127.f, ""));
+
+    mergeNotes(s, false);
+}
+
+bool
+NoteEdit::commit()
+{
+    if (!m_loaded) return false;
+    
+    auto model = ModelById::getAs<NoteModel>(m_noteModel);
+    if (!model) return false;
+
+    EventVector current;
+    current.reserve(m_notes.size());
+    for (const auto &n: m_notes) {
+        current.push_back(n.second);
+    }
+    std::sort(current.begin(), current.end());
+
+    EventVector toRemove, toAdd;
+    std::set_difference(m_original.begin(), m_original.end(),
+                        current.begin(), current.end(),
+                        std::back_inserter(toRemove));
+    std::set_difference(current.begin(), current.end(),
+                        m_original.begin(), m_original.end(),
+                        std::back_inserter(toAdd));
+
+    m_original = current;
+    
+    if (toRemove.empty() && toAdd.empty()) return false;
+
+    ChangeEventsCommand *command =
+        new ChangeEventsCommand(m_noteModel.untyped, m_name);
+
+    for (const auto &e: toRemove) command->remove(e);
+    for (const auto &e: toAdd) command->add(e);
+
+    Command *c = command->finish();
+    if (!c) return false;
+
+    // The command's parts were carried out as they were added to it
+    CommandHistory::getInstance()->addCommand(c, false);
+    return true;
+}
@@ -0,0 +1,103 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef NOTE_EDIT_H
+#define NOTE_EDIT_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+#include "base/Selection.h"
+#include "data/model/Model.h"
+
+#include <QString>
+
+#include <map>
+
+/**
+ * An edit to the notes in a NoteModel, built up from the note
+ * operations of FlexiNoteLayer applied to any number of selections,
+ * and then applied to the model as a single undoable command holding
+ * only the difference between the notes before and after.
+ *
+ * The operations work on a copy of the notes, so that each sees the
+ * result of those before it, just as when they are carried out on
+ * the layer one at a time, but the model itself is changed (and
+ * notifies its views) only once, in commit().
+ */
+class NoteEdit
+{
+public:
+    /**
+     * Edit the notes in the given note model. Where an operation
+     * makes a new note, its pitch is taken from the given pitch track
+     * model if it has any pitches there. If intelligent is true, as
+     * for FlexiNoteLayer's intelligent actions, a note split into
+     * parts keeps only those parts that have pitches.
+     */
+    NoteEdit(sv::ModelId noteModel, sv::ModelId pitchModel,
+             bool intelligent, QString name);
+
+    /**
+     * Delete the notes that overlap the selection, as
+     * FlexiNoteLayer::deleteSelectionInclusive does.
+     */
+    void deleteNotes(sv::Selection s);
+
+    /**
+     * Merge the notes in the selection into one, as
+     * FlexiNoteLayer::mergeNotes does. If inclusive is true, this
+     * includes all notes that overlap the selection, otherwise only
+     * those that lie within it.
+     */
+    void mergeNotes(sv::Selection s, bool inclusive);
+
+    /**
+     * Replace whatever is in the selection with a single note
+     * spanning it, splitting any note that crosses either end.
+     */
+    void formNote(sv::Selection s);
+
+    /**
+     * Apply the edit to the model and add it to the command history.
+     * Return false if the model has gone or there was nothing to do.
+     */
+    bool commit();
+
+protected:
+    typedef std::multimap<sv::sv_frame_t, sv::Event> Notes; // by frame
+    
+    sv::ModelId m_noteModel;
+    sv::ModelId m_pitchModel;
+    bool m_intelligent;
+    QString m_name;
+
+    bool m_loaded;
+    sv::EventVector m_original; // sorted
+    Notes m_notes;
+    sv::sv_frame_t m_maxDuration;
+
+    bool load();
+    void add(const sv::Event &e);
+    void remove(const sv::Event &e);
+
+    // These follow the corresponding EventSeries queries
+    sv::EventVector getSpanning(sv::sv_frame_t start, sv::sv_frame_t end) const;
+    sv::EventVector getWithin(sv::sv_frame_t start, sv::sv_frame_t end) const;
+    sv::EventVector getStartingWithin(sv::sv_frame_t start, sv::sv_frame_t end) const;
+    
+    void splitAt(sv::sv_frame_t frame);
+    bool updateValueFromPitches(sv::Event &note) const;
+};
+
+#endif
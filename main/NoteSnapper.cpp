@@ -0,0 +1,233 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "NoteSnapper.h"
+
+#include "data/model/NoteModel.h"
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/EventCommands.h"
+#include "base/CommandHistory.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace sv;
+
+NoteSnapper::NoteSnapper(QObject *parent) :
+    QObject(parent),
+    m_snapping(false)
+{
+}
+
+NoteSnapper::~NoteSnapper()
+{
+}
+
+void
+NoteSnapper::setModels(ModelId pitchModel, ModelId noteModel)
+{
+    follow(m_pitchModel, false);
+    follow(m_noteModel, false);
+
+    m_pitchModel = pitchModel;
+    m_noteModel = noteModel;
+
+    follow(m_pitchModel, true);
+    follow(m_noteModel, true);
+
+    m_changed.clear();
+    markChanged(std::numeric_limits<sv_frame_t>::min(),
+                std::numeric_limits<sv_frame_t>::max());
+}
+
+void
+NoteSnapper::follow(ModelId modelId, bool connecting)
+{
+    auto model = ModelById::get(modelId);
+    if (!model) return;
+
+    if (connecting) {
+        connect(model.get(), SIGNAL(modelChanged(ModelId)),
+                this, SLOT(modelChanged(ModelId)));
+        connect(model.get(), SIGNAL(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)),
+                this, SLOT(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)));
+    } else {
+        disconnect(model.get(), SIGNAL(modelChanged(ModelId)),
+                   this, SLOT(modelChanged(ModelId)));
+        disconnect(model.get(), SIGNAL(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)),
+                   this, SLOT(modelChangedWithin(ModelId, sv_frame_t, sv_frame_t)));
+    }
+}
+
+void
+NoteSnapper::modelChanged(ModelId modelId)
+{
+    if (m_snapping && modelId == m_noteModel) return;
+    
+    markChanged(std::numeric_limits<sv_frame_t>::min(),
+                std::numeric_limits<sv_frame_t>::max());
+}
+
+void
+NoteSnapper::modelChangedWithin(ModelId modelId,
+                                sv_frame_t start, sv_frame_t end)
+{
+    // Our own changes to the notes leave them snapped
+    if (m_snapping && modelId == m_noteModel) return;
+
+    markChanged(start, end);
+}
+
+void
+NoteSnapper::markChanged(sv_frame_t start, sv_frame_t end)
+{
+    if (end < start) return;
+
+    // Merge with any ranges this overlaps
+
+    auto i0 = std::lower_bound(m_changed.begin(), m_changed.end(), start,
+                               [](const Range &r, sv_frame_t f) {
+                                   return r.second < f;
+                               });
+    auto i1 = i0;
+    while (i1 != m_changed.end() && i1->first <= end) {
+        start = std::min(start, i1->first);
+        end = std::max(end, i1->second);
+        ++i1;
+    }
+
+    i0 = m_changed.erase(i0, i1);
+    m_changed.insert(i0, Range(start, end));
+}
+
+void
+NoteSnapper::markSnapped(sv_frame_t start, sv_frame_t end)
+{
+    if (end < start) return;
+
+    auto i0 = std::lower_bound(m_changed.begin(), m_changed.end(), start,
+                               [](const Range &r, sv_frame_t f) {
+                                   return r.second < f;
+                               });
+    auto i1 = i0;
+    while (i1 != m_changed.end() && i1->first <= end) ++i1;
+    if (i0 == i1) return;
+
+    // Keep whatever sticks out at either end
+
+    std::vector<Range> remaining;
+    if (i0->first < start) {
+        remaining.push_back(Range(i0->first, start - 1));
+    }
+    if ((i1 - 1)->second > end) {
+        remaining.push_back(Range(end + 1, (i1 - 1)->second));
+    }
+
+    i0 = m_changed.erase(i0, i1);
+    m_changed.insert(i0, remaining.begin(), remaining.end());
+}
+
+bool
+NoteSnapper::isChanged(sv_frame_t start, sv_frame_t end) const
+{
+    auto i = std::lower_bound(m_changed.begin(), m_changed.end(), start,
+                              [](const Range &r, sv_frame_t f) {
+                                  return r.second < f;
+                              });
+    return i != m_changed.end() && i->first <= end;
+}
+
+bool
+NoteSnapper::getMedian(std::vector<double> &values, double &median)
+{
+    size_t n = values.size();
+    if (n == 0) return false;
+
+    // The upper middle value, and for an even count the lower one,
+    // which is the largest of those below it
+    
+    auto mid = values.begin() + n / 2;
+    std::nth_element(values.begin(), mid, values.end());
+    median = *mid;
+
+    if (n % 2 == 0) {
+        median = (*std::max_element(values.begin(), mid) + median) / 2.0;
+    }
+    return true;
+}
+
+bool
+NoteSnapper::snap(Selection s, bool all)
+{
+    auto pitches = ModelById::getAs<SparseTimeValueModel>(m_pitchModel);
+    auto notes = ModelById::getAs<NoteModel>(m_noteModel);
+    if (!pitches || !notes) return false;
+
+    sv_frame_t start = s.getStartFrame();
+    sv_frame_t end = s.getEndFrame();
+
+    ChangeEventsCommand *command =
+        new ChangeEventsCommand(m_noteModel.untyped, tr("Snap Notes"));
+
+    EventVector selected = notes->getEventsStartingWithin(start, end - start);
+
+    m_snapping = true;
+    
+    for (const Event &note: selected) {
+
+        sv_frame_t noteEnd = note.getFrame() + note.getDuration();
+        
+        if (!all && !isChanged(note.getFrame(), noteEnd)) {
+            continue;
+        }
+
+        m_values.clear();
+        for (const Event &p: pitches->getEventsSpanning(note.getFrame(),
+                                                        note.getDuration())) {
+            m_values.push_back(p.getValue());
+        }
+
+        // As in FlexiNoteLayer, a note with no pitches under it (as
+        // after Clear Pitches) goes altogether
+        
+        double median = 0.0;
+        if (getMedian(m_values, median)) {
+            Event snapped = note.withValue(float(median));
+            if (!(snapped == note)) {
+                command->remove(note);
+                command->add(snapped);
+            }
+        } else {
+            command->remove(note);
+        }
+    }
+
+    Command *c = command->finish();
+
+    m_snapping = false;
+
+    // The notes we looked at now have their median pitches, whatever
+    // changed within them before. Changes elsewhere, including within
+    // a note that starts before the selection, still count
+    
+    for (const Event &note: selected) {
+        markSnapped(note.getFrame(), note.getFrame() + note.getDuration());
+    }
+    
+    if (!c) return false;
+
+    // The command's parts were carried out as they were added to it
+    CommandHistory::getInstance()->addCommand(c, false);
+    return true;
+}
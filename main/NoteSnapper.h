@@ -0,0 +1,90 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef NOTE_SNAPPER_H
+#define NOTE_SNAPPER_H
+
+#include "base/BaseTypes.h"
+#include "base/Selection.h"
+#include "data/model/Model.h"
+
+#include <QObject>
+
+#include <utility>
+#include <vector>
+
+/**
+ * Sets the pitch of each note to the median of the pitch track over
+ * its extent, or removes the note if there are no pitches there, as
+ * FlexiNoteLayer::snapSelectedNotesToPitchTrack does, but only for
+ * the notes that need it.
+ *
+ * The snapper watches the pitch and note models for changes, and
+ * keeps the ranges of frames in which something has changed since
+ * the notes there were last snapped. A note that overlaps none of
+ * these already has the median pitch, so snapping a long selection
+ * after a small edit recalculates only the few notes the edit
+ * touched.
+ */
+class NoteSnapper : public QObject
+{
+    Q_OBJECT
+
+public:
+    NoteSnapper(QObject *parent = 0);
+    virtual ~NoteSnapper();
+
+    /**
+     * Follow the given pitch track and note models. Until a note has
+     * been snapped, it is assumed to need snapping.
+     */
+    void setModels(sv::ModelId pitchModel, sv::ModelId noteModel);
+
+    sv::ModelId getPitchModel() const { return m_pitchModel; }
+    sv::ModelId getNoteModel() const { return m_noteModel; }
+
+    /**
+     * Snap the notes starting within the selection, as a single
+     * undoable command: those affected by a change since they were
+     * last snapped, or all of them if all is true. Return false if
+     * there was nothing to change.
+     */
+    bool snap(sv::Selection s, bool all);
+
+    /**
+     * Set median to the median of the given values, reordering them,
+     * and return true, or return false if there are none.
+     */
+    static bool getMedian(std::vector<double> &values, double &median);
+
+protected slots:
+    void modelChanged(sv::ModelId);
+    void modelChangedWithin(sv::ModelId, sv::sv_frame_t, sv::sv_frame_t);
+
+protected:
+    typedef std::pair<sv::sv_frame_t, sv::sv_frame_t> Range;
+
+    sv::ModelId m_pitchModel;
+    sv::ModelId m_noteModel;
+    bool m_snapping;
+    std::vector<Range> m_changed; // sorted, disjoint, ends inclusive
+    std::vector<double> m_values; // scratch space for medians
+
+    void follow(sv::ModelId model, bool connecting);
+    void markChanged(sv::sv_frame_t start, sv::sv_frame_t end);
+    void markSnapped(sv::sv_frame_t start, sv::sv_frame_t end);
+    bool isChanged(sv::sv_frame_t start, sv::sv_frame_t end) const;
+};
+
+#endif
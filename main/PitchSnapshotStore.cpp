@@ -0,0 +1,141 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "PitchSnapshotStore.h"
+
+using namespace sv;
+
+// Enough to step back through a long editing session on one phrase,
+// while costing little next to the pitch track itself
+static const int maxSnapshots = 64;
+static const size_t maxBytes = 8 * 1024 * 1024;
+
+PitchSnapshotStore::PitchSnapshotStore() :
+    m_bytes(0)
+{
+}
+
+PitchSnapshotStore::Snapshot
+PitchSnapshotStore::encode(sv_frame_t start, sv_frame_t end,
+                           const EventVector &events)
+{
+    Snapshot s;
+    s.start = start;
+    s.end = end;
+    s.first = events.empty() ? 0 : events.begin()->getFrame();
+    s.values.reserve(events.size());
+
+    // Seven bits of difference per byte, with the top bit set on all
+    // but the last byte of each
+
+    sv_frame_t prev = s.first;
+    for (const auto &e: events) {
+        uint64_t delta = uint64_t(e.getFrame() - prev);
+        prev = e.getFrame();
+        while (delta >= 0x80) {
+            s.deltas.push_back(uint8_t(delta | 0x80));
+            delta >>= 7;
+        }
+        s.deltas.push_back(uint8_t(delta));
+        s.values.push_back(e.getValue());
+    }
+
+    s.deltas.shrink_to_fit();
+    return s;
+}
+
+EventVector
+PitchSnapshotStore::decode(const Snapshot &s)
+{
+    EventVector events;
+    events.reserve(s.values.size());
+
+    sv_frame_t frame = s.first;
+    size_t j = 0;
+    for (float value: s.values) {
+        uint64_t delta = 0;
+        int shift = 0;
+        while (j < s.deltas.size()) {
+            uint8_t b = s.deltas[j++];
+            delta |= uint64_t(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) break;
+        }
+        frame += sv_frame_t(delta);
+        events.push_back(Event(frame, value, ""));
+    }
+
+    return events;
+}
+
+void
+PitchSnapshotStore::push(sv_frame_t start, sv_frame_t end,
+                         const EventVector &events)
+{
+    Snapshot s = encode(start, end, events);
+
+    for (auto i = m_snapshots.rbegin(); i != m_snapshots.rend(); ++i) {
+        if (i->start == start && i->end == end) {
+            if (*i == s) return;
+            break;
+        }
+    }
+
+    m_bytes += s.getByteCount();
+    m_snapshots.push_back(std::move(s));
+
+    while (!m_snapshots.empty() &&
+           (int(m_snapshots.size()) > maxSnapshots || m_bytes > maxBytes)) {
+        m_bytes -= m_snapshots.front().getByteCount();
+        m_snapshots.pop_front();
+    }
+}
+
+bool
+PitchSnapshotStore::pop(sv_frame_t start, sv_frame_t end,
+                        const EventVector &current, EventVector &restored)
+{
+    Snapshot now = encode(start, end, current);
+
+    for (int i = int(m_snapshots.size()) - 1; i >= 0; --i) {
+
+        const Snapshot &s = m_snapshots[i];
+        if (s.start != start || s.end != end) continue;
+
+        if (s == now) {
+            // The region is as it was when this was taken, e.g. it
+            // was selected again after an accepted re-analysis.
+            // Abandoning that selection should leave it alone, so
+            // this snapshot goes but nothing is restored: only
+            // abandoning again steps back to the one before
+            m_bytes -= s.getByteCount();
+            m_snapshots.erase(m_snapshots.begin() + i);
+            return false;
+        }
+
+        restored = decode(s);
+        m_bytes -= s.getByteCount();
+        m_snapshots.erase(m_snapshots.begin() + i);
+        return true;
+    }
+
+    return false;
+}
+
+void
+PitchSnapshotStore::clear()
+{
+    m_snapshots.clear();
+    m_bytes = 0;
+}
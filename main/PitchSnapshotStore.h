@@ -0,0 +1,90 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef PITCH_SNAPSHOT_STORE_H
+#define PITCH_SNAPSHOT_STORE_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * The pitches in regions of the pitch track as they were before each
+ * re-analysis, so that the re-analysis can be abandoned and the
+ * earlier state restored, and then the state before that, and so on.
+ *
+ * Only the frame and value of each pitch are kept. Frames are stored
+ * as variable-length differences from the previous frame, which on
+ * the analysis grid take a byte or two each, and values as floats.
+ * The store holds a limited number of snapshots, and a limited total
+ * size, and discards the oldest first.
+ */
+class PitchSnapshotStore
+{
+public:
+    PitchSnapshotStore();
+
+    /**
+     * Record the pitches found in the region from start to end,
+     * unless they are the same as the most recent snapshot of that
+     * region. Events must be in frame order.
+     */
+    void push(sv::sv_frame_t start, sv::sv_frame_t end,
+              const sv::EventVector &events);
+
+    /**
+     * Remove the most recent snapshot of the region from start to
+     * end. If it differs from the given current contents of the
+     * region, return its pitches in restored and return true. If it
+     * is the same as the current contents, restoring it would change
+     * nothing, so return false; a further call will then find the
+     * snapshot before it. Return false also if there is none.
+     */
+    bool pop(sv::sv_frame_t start, sv::sv_frame_t end,
+             const sv::EventVector &current, sv::EventVector &restored);
+
+    void clear();
+
+    int getSnapshotCount() const { return int(m_snapshots.size()); }
+    size_t getByteCount() const { return m_bytes; }
+
+protected:
+    struct Snapshot {
+        sv::sv_frame_t start;
+        sv::sv_frame_t end;
+        sv::sv_frame_t first;
+        std::vector<uint8_t> deltas;
+        std::vector<float> values;
+        size_t getByteCount() const {
+            return sizeof(Snapshot) + deltas.size() + values.size() * sizeof(float);
+        }
+        bool operator==(const Snapshot &s) const {
+            return start == s.start && end == s.end && first == s.first &&
+                deltas == s.deltas && values == s.values;
+        }
+    };
+
+    std::deque<Snapshot> m_snapshots; // oldest first
+    size_t m_bytes;
+
+    static Snapshot encode(sv::sv_frame_t start, sv::sv_frame_t end,
+                           const sv::EventVector &events);
+    static sv::EventVector decode(const Snapshot &);
+};
+
+#endif
@@ -0,0 +1,198 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "PitchTrackWriter.h"
+
+#include "data/model/SparseTimeValueModel.h"
+#include "base/DataExportOptions.h"
+#include "base/RealTime.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+using namespace sv;
+
+// Text is written to the file a megabyte at a time
+static const size_t bufferSize = 1 << 20;
+
+// Longest row we format ourselves: the time, with up to 10 digits of
+// seconds and 9 of nanoseconds, the delimiter, and the value, which
+// has at most 6 significant digits in %g style
+static const size_t maxRowSize = 64;
+
+// Events are fetched from the model this many hops at a time
+static const sv_frame_t hopsPerChunk = 65536;
+
+PitchTrackWriter::PitchTrackWriter(QString path, QString delimiter) :
+    m_path(path),
+    m_delimiter(delimiter),
+    m_delimiterUtf8(delimiter.toStdString()),
+    m_buffer(bufferSize),
+    m_used(0),
+    m_failed(false)
+{
+}
+
+PitchTrackWriter::~PitchTrackWriter()
+{
+}
+
+QString
+PitchTrackWriter::write(const SparseTimeValueModel &model)
+{
+    m_file.setFileName(m_path);
+
+    // We do our own buffering, so QFile needn't
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Text |
+                     QIODevice::Truncate | QIODevice::Unbuffered)) {
+        return tr("Failed to open file \"%1\" for writing: %2")
+            .arg(m_path).arg(m_file.errorString());
+    }
+
+    m_used = 0;
+    m_failed = false;
+
+    sv_samplerate_t rate = model.getSampleRate();
+    sv_frame_t step = std::max(model.getResolution(), 1);
+    sv_frame_t chunk = step * hopsPerChunk;
+    sv_frame_t end = model.getEndFrame();
+
+    // As CSVFileWriter does with DataExportFillGaps, the rows run a
+    // hop apart from the model's start frame (that of its first
+    // pitch) to its end frame, with a zero row for each hop in a gap
+    // between pitches and after the last one. The batch analyser's
+    // streaming output fills in the same way
+    
+    sv_frame_t next = model.getStartFrame();
+    
+    for (sv_frame_t f = model.getStartFrame(); f < end && !m_failed;
+         f += chunk) {
+        for (const Event &e: model.getEventsStartingWithin(f, chunk)) {
+            while (next < e.getFrame()) {
+                writeRow(Event(next, 0.f, ""), rate);
+                next += step;
+            }
+            writeRow(e, rate);
+            next = e.getFrame() + step;
+        }
+    }
+
+    while (next < end && !m_failed) {
+        writeRow(Event(next, 0.f, ""), rate);
+        next += step;
+    }
+
+    flush();
+
+    QString error;
+    if (m_failed) {
+        error = tr("Failed to write file \"%1\": %2")
+            .arg(m_path).arg(m_file.errorString());
+    }
+
+    m_file.close();
+
+    if (error == "" && m_file.error() != QFileDevice::NoError) {
+        error = tr("Failed to write file \"%1\": %2")
+            .arg(m_path).arg(m_file.errorString());
+    }
+    
+    return error;
+}
+
+void
+PitchTrackWriter::writeRow(const Event &e, sv_samplerate_t rate)
+{
+    // Anything more than a time and value (which a pitch track
+    // rarely has) goes the long way round, to be sure of matching
+    // what CSVFileWriter would write
+    
+    if (e.getFrame() < 0 || e.hasDuration() || e.hasLevel() ||
+        e.getLabel() != "") {
+        writeText(e.toDelimitedDataString(m_delimiter, DataExportFillGaps,
+                                          rate) + "\n");
+        return;
+    }
+
+    reserve(maxRowSize + m_delimiterUtf8.size());
+    writeTime(e.getFrame(), rate);
+    memcpy(m_buffer.data() + m_used,
+           m_delimiterUtf8.data(), m_delimiterUtf8.size());
+    m_used += m_delimiterUtf8.size();
+    writeValue(e.getValue());
+    m_buffer[m_used++] = '\n';
+}
+
+void
+PitchTrackWriter::writeTime(sv_frame_t frame, sv_samplerate_t rate)
+{
+    // As RealTime::toString, with all nine digits of nanoseconds
+
+    RealTime rt = RealTime::frame2RealTime(frame, rate);
+
+    char *p = m_buffer.data() + m_used;
+    p = std::to_chars(p, p + 12, rt.sec).ptr;
+    *p++ = '.';
+    int nsec = rt.nsec;
+    for (int i = 8; i >= 0; --i) {
+        p[i] = char('0' + nsec % 10);
+        nsec /= 10;
+    }
+    m_used = (p + 9) - m_buffer.data();
+}
+
+void
+PitchTrackWriter::writeValue(float value)
+{
+    // As QString::arg(double), i.e. %g with 6 significant digits
+
+    char *p = m_buffer.data() + m_used;
+#ifdef __cpp_lib_to_chars
+    p = std::to_chars(p, p + 32, double(value),
+                      std::chars_format::general, 6).ptr;
+    m_used = p - m_buffer.data();
+#else
+    m_used += snprintf(p, 32, "%.6g", double(value));
+#endif
+}
+
+void
+PitchTrackWriter::writeText(const QString &text)
+{
+    QByteArray bytes = text.toUtf8();
+    reserve(bytes.size());
+    if (size_t(bytes.size()) > m_buffer.size()) {
+        if (m_file.write(bytes) != bytes.size()) m_failed = true;
+        return;
+    }
+    memcpy(m_buffer.data() + m_used, bytes.data(), bytes.size());
+    m_used += bytes.size();
+}
+
+void
+PitchTrackWriter::reserve(size_t n)
+{
+    if (m_used + n > m_buffer.size()) flush();
+}
+
+void
+PitchTrackWriter::flush()
+{
+    if (m_used == 0 || m_failed) return;
+    if (m_file.write(m_buffer.data(), qint64(m_used)) != qint64(m_used)) {
+        m_failed = true;
+    }
+    m_used = 0;
+}
@@ -0,0 +1,75 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef PITCH_TRACK_WRITER_H
+#define PITCH_TRACK_WRITER_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QString>
+
+#include <string>
+
+#include <vector>
+
+namespace sv {
+class SparseTimeValueModel;
+}
+
+/**
+ * Writes a pitch track to a CSV or tab-separated file with one row
+ * per hop, as CSVFileWriter does with DataExportFillGaps: a row for
+ * each pitch, and a zero row for each hop in a gap between them or
+ * after the last one, up to the model's end frame.
+ *
+ * Rather than building the whole gap-filled grid as text first, the
+ * writer walks the model's events and makes the gap rows as it goes,
+ * formatting each row directly into a fixed buffer that is written
+ * out to the file whenever it fills.
+ */
+class PitchTrackWriter
+{
+    Q_DECLARE_TR_FUNCTIONS(PitchTrackWriter)
+
+public:
+    PitchTrackWriter(QString path, QString delimiter);
+    ~PitchTrackWriter();
+
+    /**
+     * Write the model's pitches. Return an error message, or an
+     * empty string on success.
+     */
+    QString write(const sv::SparseTimeValueModel &model);
+
+protected:
+    QString m_path;
+    QString m_delimiter;
+    std::string m_delimiterUtf8;
+    QFile m_file;
+    std::vector<char> m_buffer;
+    size_t m_used;
+    bool m_failed;
+
+    void writeRow(const sv::Event &e, sv::sv_samplerate_t rate);
+    void writeTime(sv::sv_frame_t frame, sv::sv_samplerate_t rate);
+    void writeValue(float value);
+    void writeText(const QString &text);
+    void reserve(size_t n);
+    void flush();
+};
+
+#endif
@@ -0,0 +1,107 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RegionEdit.h"
+
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/EventCommands.h"
+#include "base/CommandHistory.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace sv;
+
+RegionEdit::RegionEdit(ModelId model, QString name) :
+    m_model(model),
+    m_name(name)
+{
+}
+
+void
+RegionEdit::replace(sv_frame_t start, sv_frame_t end, const EventVector &events)
+{
+    auto model = ModelById::getAs<SparseTimeValueModel>(m_model);
+    if (!model || end <= start) return;
+
+    for (const auto &e: model->getEventsStartingWithin(start, end - start)) {
+        m_removed.push_back(e);
+    }
+    m_added.insert(m_added.end(), events.begin(), events.end());
+}
+
+void
+RegionEdit::replaceAll(const EventVector &events)
+{
+    auto model = ModelById::getAs<SparseTimeValueModel>(m_model);
+    if (!model) return;
+
+    for (const auto &e: model->getAllEvents()) {
+        m_removed.push_back(e);
+    }
+    m_added.insert(m_added.end(), events.begin(), events.end());
+}
+
+void
+RegionEdit::map(sv_frame_t start, sv_frame_t end, Mapping mapping)
+{
+    auto model = ModelById::getAs<SparseTimeValueModel>(m_model);
+    if (!model || end <= start) return;
+
+    for (const auto &e: model->getEventsStartingWithin(start, end - start)) {
+        Event mapped = mapping(e);
+        if (!(mapped == e)) {
+            m_removed.push_back(e);
+            m_added.push_back(mapped);
+        }
+    }
+}
+
+bool
+RegionEdit::commit()
+{
+    auto model = ModelById::getAs<SparseTimeValueModel>(m_model);
+    if (!model) return false;
+
+    // Anything both removed and added is already as it should be
+
+    std::sort(m_removed.begin(), m_removed.end());
+    std::sort(m_added.begin(), m_added.end());
+
+    EventVector toRemove, toAdd;
+    std::set_difference(m_removed.begin(), m_removed.end(),
+                        m_added.begin(), m_added.end(),
+                        std::back_inserter(toRemove));
+    std::set_difference(m_added.begin(), m_added.end(),
+                        m_removed.begin(), m_removed.end(),
+                        std::back_inserter(toAdd));
+
+    m_removed.clear();
+    m_added.clear();
+    
+    if (toRemove.empty() && toAdd.empty()) return false;
+
+    ChangeEventsCommand *command =
+        new ChangeEventsCommand(m_model.untyped, m_name);
+
+    for (const auto &e: toRemove) command->remove(e);
+    for (const auto &e: toAdd) command->add(e);
+
+    Command *c = command->finish();
+    if (!c) return false;
+
+    // The command's parts were carried out as they were added to it
+    CommandHistory::getInstance()->addCommand(c, false);
+    return true;
+}
@@ -0,0 +1,76 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef REGION_EDIT_H
+#define REGION_EDIT_H
+
+#include "base/Event.h"
+#include "base/BaseTypes.h"
+#include "data/model/Model.h"
+
+#include <QString>
+
+#include <functional>
+
+/**
+ * An edit to regions of a SparseTimeValueModel such as the pitch
+ * track, built up from replacements and mappings of the events in
+ * each region and then applied to the model directly, as a single
+ * undoable command.
+ *
+ * This is for edits the Analyser makes on the user's behalf, which
+ * would otherwise go through a layer's copy, deleteSelection and
+ * paste, with a Clipboard holding a copy of the events in between.
+ * Events that an edit would remove and then add back unchanged are
+ * left alone.
+ */
+class RegionEdit
+{
+public:
+    typedef std::function<sv::Event(const sv::Event &)> Mapping;
+    
+    RegionEdit(sv::ModelId model, QString name);
+
+    /**
+     * Replace the events starting from start up to end with the given
+     * ones, which should lie within the same range.
+     */
+    void replace(sv::sv_frame_t start, sv::sv_frame_t end,
+                 const sv::EventVector &events);
+
+    /**
+     * Replace all of the events in the model with the given ones.
+     */
+    void replaceAll(const sv::EventVector &events);
+
+    /**
+     * Replace each event starting from start up to end with the
+     * result of calling the given mapping on it.
+     */
+    void map(sv::sv_frame_t start, sv::sv_frame_t end, Mapping mapping);
+
+    /**
+     * Apply the edit to the model and add it to the command history.
+     * Return false if the model has gone or there was nothing to do.
+     */
+    bool commit();
+
+protected:
+    sv::ModelId m_model;
+    QString m_name;
+    sv::EventVector m_removed;
+    sv::EventVector m_added;
+};
+
+#endif
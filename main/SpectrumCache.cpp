@@ -0,0 +1,86 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "SpectrumCache.h"
+
+#include "data/model/FFTModel.h"
+#include "base/Window.h"
+
+using namespace sv;
+
+// About a minute of audio at 44.1kHz with a 256-sample step, or 64MB
+// of magnitudes at a block size of 4096
+static const int maxColumns = 8192;
+
+SpectrumCache::SpectrumCache(ModelId audio, int blockSize, int stepSize) :
+    m_audio(audio),
+    m_blockSize(blockSize),
+    m_stepSize(stepSize),
+    m_fft(new FFTModel(audio, -1, HanningWindow,
+                       blockSize, stepSize, blockSize))
+{
+}
+
+SpectrumCache::~SpectrumCache()
+{
+}
+
+bool
+SpectrumCache::isOK() const
+{
+    return m_fft && m_fft->isOK();
+}
+
+int
+SpectrumCache::getCapacity()
+{
+    return maxColumns;
+}
+
+int
+SpectrumCache::getColumnCount() const
+{
+    return isOK() ? m_fft->getWidth() : 0;
+}
+
+const float *
+SpectrumCache::getMagnitudes(int column)
+{
+    if (column < 0 || column >= getColumnCount()) return nullptr;
+
+    auto i = m_columns.find(column);
+    if (i != m_columns.end()) {
+        return i->second.data();
+    }
+
+    std::vector<float> mags(m_blockSize / 2 + 1, 0.f);
+    if (!m_fft->getMagnitudesAt(column, mags.data())) {
+        return nullptr;
+    }
+
+    while (int(m_order.size()) >= maxColumns) {
+        m_columns.erase(m_order.front());
+        m_order.pop_front();
+    }
+    m_order.push_back(column);
+    
+    return m_columns.emplace(column, std::move(mags)).first->second.data();
+}
+
+void
+SpectrumCache::clear()
+{
+    m_columns.clear();
+    m_order.clear();
+}
@@ -0,0 +1,75 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef SPECTRUM_CACHE_H
+#define SPECTRUM_CACHE_H
+
+#include "data/model/Model.h"
+#include "base/BaseTypes.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace sv {
+class FFTModel;
+}
+
+/**
+ * Magnitude spectra of the audio at one block and step size, kept
+ * once calculated so that analyses of the same part of the file, such
+ * as repeated frequency-constrained re-analysis of regions outlined
+ * in the same area, need not calculate them again.
+ *
+ * Columns are numbered as for FFTModel: column x is centred on frame
+ * x * stepSize and uses a Hann window. The cache holds a limited
+ * number of columns and discards the least recently calculated.
+ */
+class SpectrumCache
+{
+public:
+    SpectrumCache(sv::ModelId audio, int blockSize, int stepSize);
+    ~SpectrumCache();
+
+    sv::ModelId getAudioModel() const { return m_audio; }
+    int getBlockSize() const { return m_blockSize; }
+    int getStepSize() const { return m_stepSize; }
+
+    bool isOK() const;
+
+    /**
+     * Return the blockSize/2 + 1 magnitudes of the given column, or
+     * nullptr if it is out of range. The pointer remains valid until
+     * the cache is cleared or getCapacity() more columns have been
+     * calculated.
+     */
+    const float *getMagnitudes(int column);
+
+    static int getCapacity();
+
+    int getColumnCount() const;
+
+    void clear();
+
+protected:
+    sv::ModelId m_audio;
+    int m_blockSize;
+    int m_stepSize;
+    std::unique_ptr<sv::FFTModel> m_fft;
+    std::map<int, std::vector<float>> m_columns;
+    std::deque<int> m_order; // columns in order of calculation
+};
+
+#endif
@@ -0,0 +1,450 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "StreamingAnalyser.h"
+
+#include "base/Preferences.h"
+#include "base/Event.h"
+#include "data/fileio/FileSource.h"
+#include "data/fileio/AudioFileReader.h"
+#include "data/fileio/AudioFileReaderFactory.h"
+#include "data/fileio/MIDIFileWriter.h"
+#include "data/model/NoteModel.h"
+#include "plugin/FeatureExtractionPluginFactory.h"
+#include "transform/TransformFactory.h"
+
+#include <bqresample/Resampler.h>
+
+#include <vamp-hostsdk/Plugin.h>
+
+#include <QFile>
+#include <QTextStream>
+
+#include <iostream>
+#include <cmath>
+#include <memory>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+using namespace sv;
+
+/**
+ * Read an audio file in blocks at its native rate, returning each
+ * block resampled to the target rate, still interleaved. Only one
+ * block of input and output is held at a time.
+ */
+class ResamplingStream
+{
+public:
+    ResamplingStream(AudioFileReader *reader, sv_samplerate_t targetRate) :
+        m_reader(reader),
+        m_channels(reader->getChannelCount()),
+        m_ratio(1.0),
+        m_frame(0),
+        m_produced(0)
+    {
+        sv_samplerate_t fileRate = reader->getSampleRate();
+        if (targetRate == 0) targetRate = fileRate;
+        m_rate = targetRate;
+        m_expected = reader->getFrameCount();
+
+        if (targetRate != fileRate) {
+            m_ratio = targetRate / fileRate;
+            m_expected = sv_frame_t(round(double(m_expected) * m_ratio));
+            breakfastquay::Resampler::Parameters params;
+            params.quality = breakfastquay::Resampler::FastestTolerable;
+            params.dynamism = breakfastquay::Resampler::RatioMostlyFixed;
+            params.ratioChange = breakfastquay::Resampler::SuddenRatioChange;
+            params.initialSampleRate = fileRate;
+            params.maxBufferSize = blockFrames;
+            m_resampler.reset(new breakfastquay::Resampler(params, m_channels));
+        }
+    }
+
+    int getChannelCount() const { return m_channels; }
+    sv_samplerate_t getSampleRate() const { return m_rate; }
+    sv_frame_t getFrameCount() const { return m_expected; }
+
+    /**
+     * Fill out with the next block of interleaved frames at the
+     * target rate. Return false when there is nothing more to read.
+     */
+    bool read(vector<float> &out) {
+
+        out.clear();
+        if (m_produced >= m_expected) return false;
+
+        sv_frame_t fileFrames = m_reader->getFrameCount();
+        sv_frame_t count = std::min(sv_frame_t(blockFrames),
+                                    fileFrames - m_frame);
+        bool final = (m_frame + count >= fileFrames);
+
+        auto in = m_reader->getInterleavedFrames(m_frame, count);
+        count = sv_frame_t(in.size()) / m_channels;
+        m_frame += count;
+
+        if (!m_resampler) {
+            out.assign(in.begin(), in.end());
+        } else {
+            int capacity = int(ceil(double(count) * m_ratio)) + 64;
+            out.resize(size_t(capacity) * m_channels, 0.f);
+            int got = m_resampler->resampleInterleaved
+                (out.data(), capacity, in.data(), int(count), m_ratio, final);
+            out.resize(size_t(got) * m_channels);
+        }
+
+        // Trim or pad the tail so that we produce exactly the number
+        // of frames that loading the file at this rate would have
+
+        sv_frame_t frames = sv_frame_t(out.size()) / m_channels;
+        if (m_produced + frames > m_expected) {
+            frames = m_expected - m_produced;
+        } else if (final || count == 0) {
+            frames = m_expected - m_produced;
+        }
+        out.resize(size_t(frames) * m_channels, 0.f);
+        m_produced += frames;
+
+        return true;
+    }
+
+private:
+    static const int blockFrames = 16384;
+
+    AudioFileReader *m_reader;
+    int m_channels;
+    sv_samplerate_t m_rate;
+    double m_ratio;
+    sv_frame_t m_frame;
+    sv_frame_t m_produced;
+    sv_frame_t m_expected;
+    std::unique_ptr<breakfastquay::Resampler> m_resampler;
+};
+
+/**
+ * Write pitch and note events to their output files as they arrive,
+ * in the same format as the CSV and MIDI exports of the equivalent
+ * models. Gaps in the pitch track are filled with zero rows as the
+ * next pitch arrives, rather than by walking a complete model.
+ */
+class StreamingWriter
+{
+public:
+    StreamingWriter(sv_samplerate_t rate, int step) :
+        m_rate(rate),
+        m_step(step),
+        m_nextPitchFrame(0),
+        m_pitchStarted(false) { }
+
+    QString openPitch(QString path) {
+        return open(m_pitchFile, m_pitchStream, path);
+    }
+
+    QString openNotes(QString path) {
+        return open(m_noteFile, m_noteStream, path);
+    }
+
+    void collectNotesForMidi() {
+        m_notes.reset(new NoteModel(m_rate, m_step, false,
+                                    NoteModel::FLEXI_NOTE));
+        // Note values are in Hz, which the MIDI writer needs to know
+        // to convert them to note numbers
+        m_notes->setScaleUnits("Hz");
+    }
+
+    void addPitch(sv_frame_t frame, float value) {
+        if (!m_pitchStream) return;
+        // CSVFileWriter starts at the model's start frame, which is
+        // that of its first pitch, so there are no zero rows before it
+        if (m_pitchStarted) fillPitchTo(frame);
+        m_pitchStarted = true;
+        *m_pitchStream << Event(frame, value, "").toDelimitedDataString
+            (",", DataExportFillGaps, m_rate) << "\n";
+        m_nextPitchFrame = frame + m_step;
+    }
+
+    void addNote(sv_frame_t frame, float value, sv_frame_t duration,
+                 QString label) {
+        Event note(frame, value, duration, 1.f, label);
+        if (m_noteStream) {
+            *m_noteStream << note.toDelimitedDataString
+                (",", DataExportOmitLevel, m_rate) << "\n";
+        }
+        if (m_notes) {
+            m_notes->add(note);
+        }
+    }
+
+    QString finish(sv_frame_t endFrame, QString midiPath) {
+
+        // As with the extended end frame in the loaded analysis, the
+        // gap-filled pitch track runs to the end of the audio
+        fillPitchTo(endFrame);
+
+        QString error;
+        if (!close(m_pitchFile, m_pitchStream)) {
+            error = m_pitchFile.errorString();
+        }
+        if (!close(m_noteFile, m_noteStream) && error == "") {
+            error = m_noteFile.errorString();
+        }
+
+        if (m_notes && error == "") {
+            MIDIFileWriter writer(midiPath, m_notes.get(), m_rate);
+            writer.write();
+            if (!writer.isOK()) error = writer.getError();
+        }
+
+        return error;
+    }
+
+private:
+    sv_samplerate_t m_rate;
+    int m_step;
+    sv_frame_t m_nextPitchFrame;
+    bool m_pitchStarted;
+    QFile m_pitchFile;
+    QFile m_noteFile;
+    std::unique_ptr<QTextStream> m_pitchStream;
+    std::unique_ptr<QTextStream> m_noteStream;
+    std::unique_ptr<NoteModel> m_notes;
+
+    void fillPitchTo(sv_frame_t frame) {
+        if (!m_pitchStream) return;
+        while (m_nextPitchFrame < frame) {
+            *m_pitchStream << Event(m_nextPitchFrame, 0.f, "")
+                .toDelimitedDataString(",", DataExportFillGaps, m_rate)
+                           << "\n";
+            m_nextPitchFrame += m_step;
+        }
+    }
+
+    static QString open(QFile &file, std::unique_ptr<QTextStream> &stream,
+                        QString path) {
+        file.setFileName(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text |
+                       QIODevice::Truncate)) {
+            return StreamingAnalyser::tr("Failed to open file \"%1\" for writing: %2")
+                .arg(path).arg(file.errorString());
+        }
+        stream.reset(new QTextStream(&file));
+        return "";
+    }
+
+    static bool close(QFile &file, std::unique_ptr<QTextStream> &stream) {
+        if (!stream) return true;
+        stream->flush();
+        bool ok = (stream->status() == QTextStream::Ok);
+        stream.reset();
+        file.close();
+        return ok;
+    }
+};
+
+static int
+findOutput(const Vamp::Plugin::OutputList &outputs, std::string id)
+{
+    for (int i = 0; i < int(outputs.size()); ++i) {
+        if (outputs[i].identifier == id) return i;
+    }
+    return -1;
+}
+
+static sv_frame_t
+toFrame(const Vamp::RealTime &rt, sv_samplerate_t rate)
+{
+    return sv_frame_t(Vamp::RealTime::realTime2Frame
+                      (rt, (unsigned int)(lrint(rate))));
+}
+
+StreamingAnalyser::StreamingAnalyser(AnalysisParameters params,
+                                     Options options) :
+    BatchAnalyser(params, options)
+{
+}
+
+StreamingAnalyser::~StreamingAnalyser()
+{
+}
+
+QString
+StreamingAnalyser::analyseFile(QString audioPath) const
+{
+    FileSource source(audioPath);
+    if (!source.isAvailable()) {
+        return tr("File \"%1\" could not be opened").arg(audioPath);
+    }
+    source.waitForData();
+
+    sv_samplerate_t targetRate = 0;
+    Preferences *prefs = Preferences::getInstance();
+    if (prefs->getResampleOnLoad()) {
+        targetRate = prefs->getFixedSampleRate();
+    }
+
+    // Open at the file's own rate with no normalisation: we resample
+    // and scale here one block at a time, rather than having the
+    // reader decode and cache the whole file at the target rate
+
+    AudioFileReaderFactory::Parameters readerParams;
+    readerParams.targetRate = 0;
+    readerParams.normalisation = AudioFileReaderFactory::Normalisation::None;
+    readerParams.threadingMode = AudioFileReaderFactory::ThreadingMode::NotThreaded;
+
+    std::unique_ptr<AudioFileReader> reader
+        (AudioFileReaderFactory::createReader(source, readerParams));
+    if (!reader || !reader->isOK() || reader->getChannelCount() < 1) {
+        return tr("Audio file \"%1\" could not be decoded").arg(audioPath);
+    }
+
+    vector<float> buffer;
+
+    float gain = 1.f;
+    if (prefs->getNormaliseAudio()) {
+        ResamplingStream scan(reader.get(), targetRate);
+        float peak = 0.f;
+        while (scan.read(buffer)) {
+            for (float v: buffer) peak = std::max(peak, fabsf(v));
+        }
+        if (peak > 0.f) gain = 1.f / peak;
+    }
+
+    ResamplingStream stream(reader.get(), targetRate);
+    sv_samplerate_t rate = stream.getSampleRate();
+    int channels = stream.getChannelCount();
+
+    QString error;
+    Transforms transforms = m_params.getTransforms(rate, error);
+    if (transforms.empty()) {
+        return error;
+    }
+
+    const Transform &pitchTransform = transforms[0];
+    const Transform &noteTransform = transforms[1];
+    int step = pitchTransform.getStepSize();
+    int block = pitchTransform.getBlockSize();
+
+    auto plugin = FeatureExtractionPluginFactory::instance()->instantiatePlugin
+        (pitchTransform.getPluginIdentifier(), rate);
+    if (!plugin) {
+        return tr("Failed to load pYIN plugin for \"%1\"").arg(audioPath);
+    }
+
+    TransformFactory::getInstance()->setPluginParameters
+        (pitchTransform, plugin);
+
+    if (!plugin->initialise(1, step, block)) {
+        return tr("Failed to initialise pYIN plugin for \"%1\"")
+            .arg(audioPath);
+    }
+
+    Vamp::Plugin::OutputList outputs = plugin->getOutputDescriptors();
+    int pitchOutput = findOutput
+        (outputs, pitchTransform.getOutput().toStdString());
+    int noteOutput = findOutput
+        (outputs, noteTransform.getOutput().toStdString());
+    if (pitchOutput < 0 || noteOutput < 0) {
+        return tr("Analysis of \"%1\" returned unexpected model types")
+            .arg(audioPath);
+    }
+
+    StreamingWriter writer(rate, step);
+    if (m_options.writePitchCsv) {
+        error = writer.openPitch(getOutputPath(audioPath, "pitch.csv"));
+    }
+    if (error == "" && m_options.writeNoteCsv) {
+        error = writer.openNotes(getOutputPath(audioPath, "notes.csv"));
+    }
+    if (error != "") {
+        return error;
+    }
+    if (m_options.writeNoteMidi) {
+        writer.collectNotesForMidi();
+    }
+
+    auto handleFeatures = [&](const Vamp::Plugin::FeatureSet &features,
+                    sv_frame_t blockFrame) {
+
+        auto pi = features.find(pitchOutput);
+        if (pi != features.end()) {
+            for (const auto &f: pi->second) {
+                if (f.values.empty()) continue;
+                sv_frame_t frame = f.hasTimestamp ?
+                    toFrame(f.timestamp, rate) : blockFrame;
+                writer.addPitch(frame, f.values[0]);
+            }
+        }
+
+        auto ni = features.find(noteOutput);
+        if (ni != features.end()) {
+            for (const auto &f: ni->second) {
+                if (f.values.empty()) continue;
+                sv_frame_t frame = f.hasTimestamp ?
+                    toFrame(f.timestamp, rate) : blockFrame;
+                sv_frame_t duration = f.hasDuration ?
+                    toFrame(f.duration, rate) : 0;
+                writer.addNote(frame, f.values[0], duration,
+                               QString::fromStdString(f.label));
+            }
+        }
+    };
+
+    // Mix down and scale into a queue holding just over one processing
+    // block, and hand it to the plugin a step at a time. The final
+    // blocks are zero-padded, as in FeatureExtractionModelTransformer
+
+    sv_frame_t endFrame = stream.getFrameCount();
+    vector<float> queue;
+    queue.reserve(size_t(block) * 2);
+    sv_frame_t blockFrame = 0;
+    bool more = true;
+
+    while (blockFrame < endFrame) {
+
+        while (more && sv_frame_t(queue.size()) < block) {
+            more = stream.read(buffer);
+            sv_frame_t frames = sv_frame_t(buffer.size()) / channels;
+            for (sv_frame_t i = 0; i < frames; ++i) {
+                float sum = 0.f;
+                for (int c = 0; c < channels; ++c) {
+                    sum += buffer[i * channels + c];
+                }
+                queue.push_back(gain * sum / float(channels));
+            }
+        }
+
+        if (sv_frame_t(queue.size()) < block) {
+            queue.resize(block, 0.f);
+        }
+
+        const float *input = queue.data();
+        handleFeatures(plugin->process
+             (&input, Vamp::RealTime::frame2RealTime
+              (blockFrame, (unsigned int)(lrint(rate)))),
+             blockFrame);
+
+        queue.erase(queue.begin(), queue.begin() + step);
+        blockFrame += step;
+    }
+
+    // pYIN decodes the smoothed pitch track and notes over the whole
+    // file, so for these outputs nearly everything arrives here. Only
+    // the per-frame observations are retained until this point,
+    // never the audio.
+    handleFeatures(plugin->getRemainingFeatures(), blockFrame);
+
+    return writer.finish(endFrame, getOutputPath(audioPath, "notes.mid"));
+}
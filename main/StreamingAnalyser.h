@@ -0,0 +1,48 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef STREAMING_ANALYSER_H
+#define STREAMING_ANALYSER_H
+
+#include "BatchAnalyser.h"
+
+/**
+ * A BatchAnalyser that never holds the whole decoded file in
+ * memory. Instead of loading a WaveFileModel, it reads the audio file
+ * a block at a time, resamples and mixes it down, and feeds it
+ * straight into the pYIN plugin, writing pitch and note events to the
+ * output files as the plugin returns them.
+ *
+ * Peak normalisation needs the peak of the whole file before the
+ * first block can be scaled, so when normalisation is enabled the
+ * file is read through once beforehand to find it. This pre-scan
+ * only decodes and resamples, which is cheap compared with the
+ * analysis itself.
+ *
+ * The results are the same as those of BatchAnalyser, except where
+ * the resampler's treatment of the very start and end of the file
+ * differs slightly from that used when loading.
+ */
+class StreamingAnalyser : public BatchAnalyser
+{
+    Q_DECLARE_TR_FUNCTIONS(StreamingAnalyser)
+
+public:
+    StreamingAnalyser(AnalysisParameters params, Options options);
+    virtual ~StreamingAnalyser();
+
+    QString analyseFile(QString audioPath) const override;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+    This file copyright 2006-2012 Chris Cannam and QMUL.
+    
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "VampPath.h"
+
+#include "base/Debug.h"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QString>
+
+#include <cstdlib>
+#include <cstring>
+
+using std::endl;
+
+using namespace sv;
+
+static QString
+getEnvQStr(QString variable)
+{
+#ifdef Q_OS_WIN32
+    std::wstring wvar = variable.toStdWString();
+    wchar_t *value = _wgetenv(wvar.c_str());
+    if (!value) return QString();
+    else return QString::fromStdWString(std::wstring(value));
+#else
+    std::string var = variable.toStdString();
+    return QString::fromUtf8(qgetenv(var.c_str()));
+#endif
+}
+
+static void
+putEnvQStr(QString assignment)
+{
+#ifdef Q_OS_WIN32
+    std::wstring wassignment = assignment.toStdWString();
+    _wputenv(_wcsdup(wassignment.c_str()));
+#else
+    putenv(strdup(assignment.toUtf8().data()));
+#endif
+}
+
+void
+setupTonyVampPath()
+{
+    QString myVampPath = getEnvQStr("TONY_VAMP_PATH");
+
+#ifdef Q_OS_WIN32
+    QChar sep(';');
+#else
+    QChar sep(':');
+#endif
+    
+    if (myVampPath == "") {
+        
+        QString appName = QCoreApplication::applicationName();
+        QString myDir = QCoreApplication::applicationDirPath();
+        QString binaryName = QFileInfo(QCoreApplication::arguments().at(0))
+            .fileName();
+
+#ifdef Q_OS_WIN32
+        QString programFiles = getEnvQStr("ProgramFiles");
+        if (programFiles == "") programFiles = "C:\\Program Files";
+        QString pfPath(programFiles + "\\" + appName);
+        myVampPath = myDir + sep + pfPath;
+#else
+#ifdef Q_OS_MAC
+        myVampPath = myDir + "/../Resources";
+        (void)sep; // unused
+#else
+        if (binaryName != "") {
+            myVampPath =
+                myDir + "/../lib/" + binaryName + sep;
+        }
+        myVampPath = myVampPath +
+            myDir + "/../lib/" + appName + sep +
+            myDir;
+#endif
+#endif
+    }
+
+    SVCERR << "Setting VAMP_PATH to " << myVampPath
+           << " for Tony plugins" << endl;
+
+    QString env = "VAMP_PATH=" + myVampPath;
+
+    // Windows lacks setenv, must use putenv (different arg convention)
+    putEnvQStr(env);
+}
@@ -0,0 +1,26 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TONY_VAMP_PATH_H
+#define TONY_VAMP_PATH_H
+
+/**
+ * Set VAMP_PATH so that the plugins installed alongside the
+ * application (pYIN and CHP) are found, unless TONY_VAMP_PATH is set,
+ * in which case that is used instead. Must be called after the
+ * QCoreApplication has been constructed.
+ */
+extern void setupTonyVampPath();
+
+#endif
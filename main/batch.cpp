@@ -0,0 +1,268 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "BatchAnalyser.h"
+#include "StreamingAnalyser.h"
+#include "CorpusScheduler.h"
+#include "AnalysisParameters.h"
+#include "VampPath.h"
+
+#include "system/System.h"
+#include "system/Init.h"
+#include "base/Debug.h"
+#include "base/TempDirectory.h"
+#include "base/Preferences.h"
+#include "data/fileio/AudioFileReaderFactory.h"
+#include "transform/TransformFactory.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <QStringList>
+#include <QDir>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QThread>
+
+#include <iostream>
+#include <memory>
+#include <algorithm>
+
+#include "../version.h"
+
+using std::cerr;
+using std::endl;
+
+using namespace sv;
+
+static void
+addAudioFiles(QString path, QStringList &files)
+{
+    QFileInfo fi(path);
+    if (!fi.isDir()) {
+        files.push_back(path);
+        return;
+    }
+
+    QStringList patterns = AudioFileReaderFactory::getKnownExtensions()
+        .split(' ', Qt::SkipEmptyParts);
+
+    QStringList found;
+    QDirIterator di(path, patterns, QDir::Files | QDir::Readable,
+                    QDirIterator::Subdirectories);
+    while (di.hasNext()) {
+        found.push_back(di.next());
+    }
+    found.sort();
+    files += found;
+}
+
+static void
+usage(QString name)
+{
+    cerr << QCoreApplication::translate("BatchAnalyser", "\nAnalyse pitch track and notes of monophonic audio files without the Tony user interface.\n\nUsage:\n\n  %1 [options] <file-or-folder> [<file-or-folder> ...]\n\nFolders are searched recursively for audio files.\n\nOptions:\n\n  -j, --jobs <n>: Analyse up to <n> files in parallel (default is the number of CPU cores).\n  --max-in-flight <n>: Hold at most <n> decoded files in memory at once (default is the number of jobs).\n  -o, --output-dir <dir>: Write output files into <dir> rather than alongside each audio file.\n  --no-pitch-csv: Do not write the pitch track (<name>.pitch.csv).\n  --no-note-csv: Do not write the notes as CSV (<name>.notes.csv).\n  --no-midi: Do not write the notes as MIDI (<name>.notes.mid).\n  --streaming: Read and analyse each file a block at a time rather than loading it into memory first.\n  --chunk <seconds>: Split each file into chunks of this length, analyse them in parallel and stitch the results together.\n  --chunk-overlap <seconds>: Analyse this much audio either side of each chunk (default 4).\n  --chunk-threads <n>: Analyse up to <n> chunks of each file at once (default is the number of CPU cores divided by the number of files analysed at once).\n  --compare-chunked: Analyse each file both whole and in chunks, report how the results differ, and fail if they differ by more than the tolerance. No output files are written.\n  --precise, --no-precise: Use, or do not use, unbiased timing (slow).\n  --lowamp, --no-lowamp: Penalise, or do not penalise, soft pitches.\n  --onset, --no-onset: Use, or do not use, high onset sensitivity.\n  --prune, --no-prune: Drop, or do not drop, short notes.\n\nAnalysis options not given on the command line are taken from the\nsettings last used in the Tony application.").arg(name).toStdString() << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc == 2 && (QString(argv[1]) == "--version" ||
+                      QString(argv[1]) == "-v")) {
+        cerr << TONY_VERSION << endl;
+        exit(0);
+    }
+
+    svSystemSpecificInitialisation();
+
+    QCoreApplication application(argc, argv);
+
+    QCoreApplication::setOrganizationName("sonic-visualiser");
+    QCoreApplication::setOrganizationDomain("sonicvisualiser.org");
+    QCoreApplication::setApplicationName("Tony");
+
+    setupTonyVampPath();
+
+    QStringList args = application.arguments();
+    QString name = QFileInfo(args[0]).fileName();
+
+    if (args.contains("--help") || args.contains("-h") || args.contains("-?")) {
+        usage(name);
+        exit(0);
+    }
+
+    AnalysisParameters params = AnalysisParameters::fromSettings();
+    BatchAnalyser::Options options;
+    QStringList files;
+    int jobs = QThread::idealThreadCount();
+    int maxInFlight = 0;
+    bool streaming = false;
+    int chunkThreads = 0;
+
+    for (int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        if (arg == "-o" || arg == "--output-dir") {
+            if (i + 1 >= args.size()) {
+                usage(name);
+                exit(2);
+            }
+            options.outputDir = args[++i];
+        } else if (arg == "-j" || arg == "--jobs" ||
+                   arg == "--max-in-flight") {
+            bool ok = false;
+            int n = (i + 1 < args.size() ? args[++i].toInt(&ok) : 0);
+            if (!ok || n < 1) {
+                usage(name);
+                exit(2);
+            }
+            if (arg == "--max-in-flight") maxInFlight = n;
+            else jobs = n;
+        } else if (arg == "--no-pitch-csv") {
+            options.writePitchCsv = false;
+        } else if (arg == "--no-note-csv") {
+            options.writeNoteCsv = false;
+        } else if (arg == "--no-midi") {
+            options.writeNoteMidi = false;
+        } else if (arg == "--chunk" || arg == "--chunk-overlap") {
+            bool ok = false;
+            double d = (i + 1 < args.size() ? args[++i].toDouble(&ok) : 0);
+            if (!ok || d < 0 || (arg == "--chunk" && d == 0)) {
+                usage(name);
+                exit(2);
+            }
+            if (arg == "--chunk") options.chunkDuration = d;
+            else options.chunkOverlap = d;
+        } else if (arg == "--chunk-threads") {
+            bool ok = false;
+            int n = (i + 1 < args.size() ? args[++i].toInt(&ok) : 0);
+            if (!ok || n < 1) {
+                usage(name);
+                exit(2);
+            }
+            chunkThreads = n;
+        } else if (arg == "--compare-chunked") {
+            options.compareChunked = true;
+        } else if (arg == "--streaming") {
+            streaming = true;
+        } else if (arg == "--precise" || arg == "--no-precise") {
+            params.precise = (arg == "--precise");
+        } else if (arg == "--lowamp" || arg == "--no-lowamp") {
+            params.lowamp = (arg == "--lowamp");
+        } else if (arg == "--onset" || arg == "--no-onset") {
+            params.onset = (arg == "--onset");
+        } else if (arg == "--prune" || arg == "--no-prune") {
+            params.prune = (arg == "--prune");
+        } else if (arg.startsWith('-')) {
+            cerr << "Unknown option \"" << arg << "\"" << endl;
+            usage(name);
+            exit(2);
+        } else {
+            addAudioFiles(arg, files);
+        }
+    }
+
+    if (files.empty()) {
+        usage(name);
+        exit(2);
+    }
+
+    if (streaming &&
+        (options.chunkDuration > 0.0 || options.compareChunked)) {
+        cerr << "The --streaming option cannot be combined with chunked analysis" << endl;
+        exit(2);
+    }
+
+    if (options.compareChunked && options.chunkDuration <= 0.0) {
+        options.chunkDuration = 30.0;
+    }
+
+    if (chunkThreads < 1) {
+        // Share the cores among the files that will actually be
+        // analysed at once, so that a single long file gets all of
+        // them for its chunks
+        int concurrent = std::min(jobs, int(files.size()));
+        if (maxInFlight > 0) concurrent = std::min(concurrent, maxInFlight);
+        concurrent = std::max(concurrent, 1);
+        chunkThreads = std::max(QThread::idealThreadCount() / concurrent, 1);
+    }
+    options.chunkThreads = chunkThreads;
+
+    if (options.outputDir != "" && !QDir().mkpath(options.outputDir)) {
+        cerr << "Failed to create output directory \""
+             << options.outputDir << "\"" << endl;
+        exit(1);
+    }
+
+    // These must match the settings made in the MainWindow
+    // constructor, so that we analyse the same audio as the
+    // interactive application would
+
+    Preferences::getInstance()->setResampleOnLoad(true);
+    Preferences::getInstance()->setFixedSampleRate(44100);
+    Preferences::getInstance()->setNormaliseAudio(true);
+
+    QSettings settings;
+    settings.beginGroup("Transformer");
+    settings.setValue("use-flexi-note-model", true);
+    settings.endGroup();
+
+    // Check the plugin is available before starting any threads;
+    // this also ensures the transform factory has been populated
+    // before it is used concurrently
+    QString error;
+    if (params.getTransforms(44100, error).empty()) {
+        cerr << "ERROR: " << error << endl;
+        exit(1);
+    }
+
+    std::unique_ptr<BatchAnalyser> analyser;
+    if (streaming) {
+        analyser.reset(new StreamingAnalyser(params, options));
+    } else {
+        analyser.reset(new BatchAnalyser(params, options));
+    }
+
+    if (maxInFlight < 1) maxInFlight = jobs;
+    CorpusScheduler scheduler(jobs, maxInFlight);
+
+    cerr << "Analysing " << files.size() << " file(s) with " << jobs
+         << " thread(s)" << endl;
+
+    int done = 0;
+
+    int failures = scheduler.run
+        (files,
+         [&](QString path) {
+             return analyser->analyseFile(path);
+         },
+         [&](QString path, QString error) {
+             ++done;
+             if (error != "") {
+                 cerr << "[" << done << "/" << files.size() << "] ERROR: "
+                      << error << endl;
+             } else {
+                 cerr << "[" << done << "/" << files.size() << "] "
+                      << path << endl;
+             }
+         });
+
+    TransformFactory::deleteInstance();
+    TempDirectory::getInstance()->cleanup();
+
+    if (failures > 0) {
+        cerr << failures << " of " << files.size()
+             << " file(s) failed" << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -14,6 +14,7 @@
 */
 
 #include "MainWindow.h"
+#include "VampPath.h"
 
 #include "system/System.h"
 #include "system/Init.h"
@@ -130,79 +131,6 @@ protected:
     }
 };
 
-static QString
-getEnvQStr(QString variable)
-{
-#ifdef Q_OS_WIN32
-    std::wstring wvar = variable.toStdWString();
-    wchar_t *value = _wgetenv(wvar.c_str());
-    if (!value) return QString();
-    else return QString::fromStdWString(std::wstring(value));
-#else
-    std::string var = variable.toStdString();
-    return QString::fromUtf8(qgetenv(var.c_str()));
-#endif
-}
-
-static void
-putEnvQStr(QString assignment)
-{
-#ifdef Q_OS_WIN32
-    std::wstring wassignment = assignment.toStdWString();
-    _wputenv(_wcsdup(wassignment.c_str()));
-#else
-    putenv(strdup(assignment.toUtf8().data()));
-#endif
-}
-
-static void
-setupTonyVampPath()
-{
-    QString myVampPath = getEnvQStr("TONY_VAMP_PATH");
-
-#ifdef Q_OS_WIN32
-    QChar sep(';');
-#else
-    QChar sep(':');
-#endif
-    
-    if (myVampPath == "") {
-        
-        QString appName = QApplication::applicationName();
-        QString myDir = QApplication::applicationDirPath();
-        QString binaryName = QFileInfo(QCoreApplication::arguments().at(0))
-            .fileName();
-
-#ifdef Q_OS_WIN32
-        QString programFiles = getEnvQStr("ProgramFiles");
-        if (programFiles == "") programFiles = "C:\\Program Files";
-        QString pfPath(programFiles + "\\" + appName);
-        myVampPath = myDir + sep + pfPath;
-#else
-#ifdef Q_OS_MAC
-        myVampPath = myDir + "/../Resources";
-        (void)sep; // unused
-#else
-        if (binaryName != "") {
-            myVampPath =
-                myDir + "/../lib/" + binaryName + sep;
-        }
-        myVampPath = myVampPath +
-            myDir + "/../lib/" + appName + sep +
-            myDir;
-#endif
-#endif
-    }
-
-    SVCERR << "Setting VAMP_PATH to " << myVampPath
-           << " for Tony plugins" << endl;
-
-    QString env = "VAMP_PATH=" + myVampPath;
-
-    // Windows lacks setenv, must use putenv (different arg convention)
-    putEnvQStr(env);
-}
-        
 int
 main(int argc, char **argv)
 {
@@ -0,0 +1,118 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_CHUNKED_ANALYSIS_H
+#define TEST_CHUNKED_ANALYSIS_H
+
+#include "../BatchAnalyser.h"
+#include "../AnalysisParameters.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QDataStream>
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Analysing a file in chunks and stitching the results together
+ * should agree with analysing it whole, within the tolerance that
+ * tony-batch --compare-chunked applies. This needs the pYIN plugin
+ * built alongside the test.
+ */
+class TestChunkedAnalysis : public QObject
+{
+    Q_OBJECT
+
+    static const int rate = 44100;
+
+    QTemporaryDir m_dir;
+
+    // A melody of harmonic tones with short rests between them, so
+    // that chunk boundaries fall in notes as well as in gaps
+    QString writeMelody(QString name, double seconds) {
+
+        const double tone = 0.45, rest = 0.15;
+        const int scale[] = { 0, 2, 4, 5, 7, 9, 11, 12, 11, 9, 7, 5, 4, 2 };
+        const int scaleLength = int(sizeof(scale) / sizeof(scale[0]));
+
+        int frames = int(seconds * rate);
+        QByteArray pcm(frames * 2, '\0');
+        qint16 *out = reinterpret_cast<qint16 *>(pcm.data());
+
+        for (int i = 0; i < frames; ++i) {
+            double t = double(i) / rate;
+            int note = int(t / (tone + rest));
+            double within = t - note * (tone + rest);
+            if (within >= tone) continue;
+            double f0 = 220.0 * pow(2.0, scale[note % scaleLength] / 12.0);
+            double fade = std::min(1.0, std::min(within, tone - within) / 0.01);
+            double v = 0.0;
+            for (int h = 1; h <= 4; ++h) {
+                v += sin(2.0 * 3.14159265358979 * f0 * h * within) / h;
+            }
+            out[i] = qint16(v * fade * 0.25 * 32767.0);
+        }
+
+        QString path = m_dir.filePath(name);
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) return "";
+
+        QDataStream ds(&file);
+        ds.setByteOrder(QDataStream::LittleEndian);
+        file.write("RIFF");
+        ds << quint32(36 + pcm.size());
+        file.write("WAVEfmt ");
+        ds << quint32(16) << quint16(1) << quint16(1)
+           << quint32(rate) << quint32(rate * 2)
+           << quint16(2) << quint16(16);
+        file.write("data");
+        ds << quint32(pcm.size());
+        file.write(pcm);
+
+        return path;
+    }
+
+    QString compare(QString path, double chunk) {
+        BatchAnalyser::Options options;
+        options.compareChunked = true;
+        options.chunkDuration = chunk;
+        options.chunkThreads = 4;
+        BatchAnalyser analyser(AnalysisParameters(), options);
+        return analyser.analyseFile(path);
+    }
+
+private slots:
+    void init() {
+        QVERIFY(m_dir.isValid());
+    }
+
+    void melody() {
+        QString path = writeMelody("melody.wav", 60.0);
+        QVERIFY(path != "");
+        QCOMPARE(compare(path, 10.0), QString());
+    }
+
+    void shortLastChunk() {
+        // The last chunk is much shorter than the others and finishes
+        // first, which should not hold up the rest
+        QString path = writeMelody("uneven.wav", 41.0);
+        QVERIFY(path != "");
+        QCOMPARE(compare(path, 10.0), QString());
+    }
+};
+
+#endif
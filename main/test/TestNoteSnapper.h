@@ -0,0 +1,119 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_NOTE_SNAPPER_H
+#define TEST_NOTE_SNAPPER_H
+
+#include "../NoteSnapper.h"
+
+#include "data/model/SparseTimeValueModel.h"
+#include "data/model/NoteModel.h"
+
+#include <QObject>
+#include <QtTest>
+
+#include <memory>
+
+using namespace sv;
+
+/**
+ * Snapping notes to the pitch track, in full and after edits, should
+ * give the same notes as FlexiNoteLayer's snap: each note at the
+ * median of the pitches under it, and no note where there are none.
+ */
+class TestNoteSnapper : public QObject
+{
+    Q_OBJECT
+
+    static const int rate = 44100;
+    static const int step = 256;
+
+    std::shared_ptr<SparseTimeValueModel> m_pitches;
+    std::shared_ptr<NoteModel> m_notes;
+    ModelId m_pitchId;
+    ModelId m_noteId;
+
+    Selection everything() const {
+        return Selection(0, 200 * step);
+    }
+
+    // Remove the pitches from start to end, as Clear Pitches does
+    void clearPitches(sv_frame_t start, sv_frame_t end) {
+        for (const Event &e: m_pitches->getEventsStartingWithin
+                 (start, end - start)) {
+            m_pitches->remove(e);
+        }
+    }
+
+private slots:
+    void init() {
+        // Pitches at 220 Hz for the first 50 hops and 330 Hz for the
+        // next 50, with a note in each half that is off pitch
+        m_pitches = std::make_shared<SparseTimeValueModel>(rate, step, true);
+        m_notes = std::make_shared<NoteModel>
+            (rate, step, true, NoteModel::FLEXI_NOTE);
+        for (int i = 0; i < 100; ++i) {
+            m_pitches->add(Event(i * step, i < 50 ? 220.f : 330.f, ""));
+        }
+        m_notes->add(Event(10 * step, 200.f, 20 * step, 1.f, ""));
+        m_notes->add(Event(60 * step, 300.f, 20 * step, 1.f, ""));
+        m_pitchId = ModelById::add(m_pitches);
+        m_noteId = ModelById::add(m_notes);
+    }
+
+    void cleanup() {
+        ModelById::release(m_pitchId);
+        ModelById::release(m_noteId);
+        m_pitches.reset();
+        m_notes.reset();
+    }
+
+    void snapAll() {
+        NoteSnapper snapper;
+        snapper.setModels(m_pitchId, m_noteId);
+        QVERIFY(snapper.snap(everything(), true));
+        EventVector notes = m_notes->getAllEvents();
+        QCOMPARE(int(notes.size()), 2);
+        QCOMPARE(notes[0].getValue(), 220.f);
+        QCOMPARE(notes[1].getValue(), 330.f);
+    }
+
+    void snapAfterClearPitches() {
+        // Clear Pitches over the second note, then snap the changed
+        // notes as MainWindow does: the note has nothing under it
+        // and goes, while the first is untouched
+        NoteSnapper snapper;
+        snapper.setModels(m_pitchId, m_noteId);
+        QVERIFY(snapper.snap(everything(), true));
+        clearPitches(55 * step, 85 * step);
+        QVERIFY(snapper.snap(Selection(55 * step, 85 * step), false));
+        EventVector notes = m_notes->getAllEvents();
+        QCOMPARE(int(notes.size()), 1);
+        QCOMPARE(notes[0].getFrame(), sv_frame_t(10 * step));
+        QCOMPARE(notes[0].getValue(), 220.f);
+    }
+
+    void snapAllAfterClearPitches() {
+        NoteSnapper snapper;
+        snapper.setModels(m_pitchId, m_noteId);
+        clearPitches(0, 40 * step);
+        QVERIFY(snapper.snap(everything(), true));
+        EventVector notes = m_notes->getAllEvents();
+        QCOMPARE(int(notes.size()), 1);
+        QCOMPARE(notes[0].getFrame(), sv_frame_t(60 * step));
+        QCOMPARE(notes[0].getValue(), 330.f);
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_PITCH_SNAPSHOT_STORE_H
+#define TEST_PITCH_SNAPSHOT_STORE_H
+
+#include "../PitchSnapshotStore.h"
+
+#include <QObject>
+#include <QtTest>
+
+using namespace sv;
+
+/**
+ * The store behind abandoning a re-analysis (Esc) of a pitch track
+ * region, driven as Analyser drives it: a snapshot is pushed when a
+ * region is selected for re-analysis, and popped against the
+ * region's current contents when the re-analysis is abandoned.
+ */
+class TestPitchSnapshotStore : public QObject
+{
+    Q_OBJECT
+
+    static const sv_frame_t start = 44100;
+    static const sv_frame_t end = 88200;
+
+    // The pitches in the region, on a 256-frame grid
+    EventVector pitches(float base) {
+        EventVector events;
+        for (sv_frame_t f = start; f < end; f += 256) {
+            events.push_back(Event(f, base + float(f % 7), ""));
+        }
+        return events;
+    }
+
+    static void compareEvents(const EventVector &a, const EventVector &b) {
+        QCOMPARE(a.size(), b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            QCOMPARE(a[i].getFrame(), b[i].getFrame());
+            QCOMPARE(a[i].getValue(), b[i].getValue());
+        }
+    }
+
+private slots:
+    void abandonRestores() {
+        // Select, switch candidate, Esc: back to the original
+        PitchSnapshotStore store;
+        EventVector original = pitches(220.f), candidate = pitches(330.f);
+        store.push(start, end, original);
+        EventVector restored;
+        QVERIFY(store.pop(start, end, candidate, restored));
+        compareEvents(restored, original);
+        QCOMPARE(store.getSnapshotCount(), 0);
+    }
+
+    void abandonAfterAcceptIsNoOp() {
+        // Select, switch candidate, accept; later select the same
+        // region again and press Esc. The accepted edit must stay
+        PitchSnapshotStore store;
+        EventVector original = pitches(220.f), candidate = pitches(330.f);
+        store.push(start, end, original);   // select
+        // switch candidate and accept: the region now holds candidate
+        store.push(start, end, candidate);  // select the same region
+        EventVector restored;
+        QVERIFY(!store.pop(start, end, candidate, restored)); // Esc
+        QVERIFY(restored.empty());
+
+        // Only abandoning again steps back to the original
+        QVERIFY(store.pop(start, end, candidate, restored));
+        compareEvents(restored, original);
+        QCOMPARE(store.getSnapshotCount(), 0);
+    }
+
+    void repeatedAbandonStepsBack() {
+        // Two re-analyses of one region, each changing it, then Esc
+        // twice: back through each in turn
+        PitchSnapshotStore store;
+        EventVector a = pitches(220.f), b = pitches(330.f), c = pitches(440.f);
+        store.push(start, end, a);
+        store.push(start, end, b);
+        EventVector restored;
+        QVERIFY(store.pop(start, end, c, restored));
+        compareEvents(restored, b);
+        QVERIFY(store.pop(start, end, b, restored));
+        compareEvents(restored, a);
+        QVERIFY(!store.pop(start, end, a, restored));
+    }
+
+    void otherRegionsUntouched() {
+        PitchSnapshotStore store;
+        EventVector a = pitches(220.f), b = pitches(330.f);
+        store.push(start, end, a);
+        store.push(0, start, b);
+        EventVector restored;
+        QVERIFY(store.pop(start, end, b, restored));
+        compareEvents(restored, a);
+        QCOMPARE(store.getSnapshotCount(), 1);
+    }
+};
+
+#endif
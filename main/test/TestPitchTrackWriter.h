@@ -0,0 +1,124 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*-  vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Tony
+    An intonation analysis and annotation tool
+    Centre for Digital Music, Queen Mary, University of London.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef TEST_PITCH_TRACK_WRITER_H
+#define TEST_PITCH_TRACK_WRITER_H
+
+#include "../PitchTrackWriter.h"
+
+#include "data/model/SparseTimeValueModel.h"
+#include "data/fileio/CSVFileWriter.h"
+
+#include <QObject>
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include <memory>
+
+using namespace sv;
+
+/**
+ * PitchTrackWriter should write exactly what CSVFileWriter does with
+ * DataExportFillGaps, byte for byte.
+ */
+class TestPitchTrackWriter : public QObject
+{
+    Q_OBJECT
+
+    static const int rate = 44100;
+    static const int step = 256;
+
+    QTemporaryDir m_dir;
+
+    QByteArray readAll(QString path) {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) return {};
+        return f.readAll();
+    }
+
+    void compare(std::shared_ptr<SparseTimeValueModel> model,
+                 QString delimiter) {
+
+        QString expectedPath = m_dir.filePath("expected.csv");
+        QString actualPath = m_dir.filePath("actual.csv");
+
+        CSVFileWriter reference(expectedPath, model.get(),
+                                delimiter, DataExportFillGaps);
+        reference.write();
+        QVERIFY(reference.isOK());
+
+        PitchTrackWriter writer(actualPath, delimiter);
+        QCOMPARE(writer.write(*model), QString());
+
+        QByteArray expected = readAll(expectedPath);
+        QByteArray actual = readAll(actualPath);
+        QVERIFY(!expected.isEmpty());
+        QCOMPARE(actual, expected);
+    }
+
+    std::shared_ptr<SparseTimeValueModel> makeModel() {
+        return std::make_shared<SparseTimeValueModel>(rate, step, false);
+    }
+
+private slots:
+    void init() {
+        QVERIFY(m_dir.isValid());
+    }
+
+    void gaps() {
+        // A leading gap before the first pitch, internal gaps of one
+        // and of many hops, and a trailing gap up to the end of the
+        // audio, with values that need rounding to six digits
+        auto model = makeModel();
+        for (int i = 10; i < 20; ++i) {
+            model->add(Event(i * step, 220.f + float(i) / 3.f, ""));
+        }
+        model->add(Event(21 * step, 0.0012345678f, ""));
+        for (int i = 200; i < 300; ++i) {
+            model->add(Event(i * step, 1234.5678f + float(i), ""));
+        }
+        model->extendEndFrame(500 * step + 17);
+        compare(model, ",");
+        compare(model, "\t");
+    }
+
+    void longTrack() {
+        // More hops than PitchTrackWriter fetches in a chunk, and more
+        // rows than fit in its buffer
+        auto model = makeModel();
+        for (int i = 0; i < 200000; ++i) {
+            if (i % 1000 < 700) {
+                model->add(Event(sv_frame_t(i) * step, 100.f + float(i % 97),
+                                 ""));
+            }
+        }
+        model->extendEndFrame(sv_frame_t(250000) * step);
+        compare(model, ",");
+    }
+
+    void noPitches() {
+        auto model = makeModel();
+        model->extendEndFrame(100 * step);
+        compare(model, ",");
+    }
+
+    void noEndExtension() {
+        auto model = makeModel();
+        model->add(Event(3 * step, 440.f, ""));
+        model->add(Event(9 * step, 441.f, ""));
+        compare(model, ",");
+    }
+};
+
+#endif